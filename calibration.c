@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "calibration.h"
+#include "fusion.h"
+#include "debug.h"
+
+#define CALIBRATION_FILE_HEADER "accel-tablet-moded calibration 1"
+
+void calibration_init(calibration_t *calibration, size_t sensors_len) {
+    memset(calibration, 0, sizeof(*calibration));
+    calibration->sensors_len = sensors_len;
+}
+
+void calibration_reset_windows(calibration_t *calibration) {
+    for (size_t i = 0; i < calibration->sensors_len; i++) {
+        calibration->sensors[i].window_len = 0;
+    }
+}
+
+// Solves the 4x4 system with partial pivoting. False if it is singular
+static bool calibration_solve(double a[4][4], double b[4], double x[4]) {
+    for (size_t col = 0; col < 4; col++) {
+        size_t pivot = col;
+        for (size_t row = col + 1; row < 4; row++) {
+            if (fabs(a[row][col]) > fabs(a[pivot][col])) pivot = row;
+        }
+        if (fabs(a[pivot][col]) < 1e-12) {
+            return false;
+        }
+        if (pivot != col) {
+            for (size_t k = 0; k < 4; k++) {
+                double tmp = a[col][k];
+                a[col][k] = a[pivot][k];
+                a[pivot][k] = tmp;
+            }
+            double tmp = b[col];
+            b[col] = b[pivot];
+            b[pivot] = tmp;
+        }
+        for (size_t row = col + 1; row < 4; row++) {
+            double k = a[row][col] / a[col][col];
+            for (size_t c = col; c < 4; c++) {
+                a[row][c] -= k * a[col][c];
+            }
+            b[row] -= k * b[col];
+        }
+    }
+    for (size_t col = 4; col-- > 0;) {
+        double sum = b[col];
+        for (size_t c = col + 1; c < 4; c++) {
+            sum -= a[col][c] * x[c];
+        }
+        x[col] = sum / a[col][col];
+    }
+    return true;
+}
+
+// Adds the mean of a stationary window to the sphere fit and solves it
+static void calibration_fit(sensor_calibration_t *sensor, const double mean[3]) {
+    double row[4] = {
+        2.0 * mean[0] / STANDARD_GRAVITY, 2.0 * mean[1] / STANDARD_GRAVITY, 2.0 * mean[2] / STANDARD_GRAVITY, 1.0
+    };
+    double value = (mean[0] * mean[0] + mean[1] * mean[1] + mean[2] * mean[2]) / (STANDARD_GRAVITY * STANDARD_GRAVITY);
+    for (size_t r = 0; r < 4; r++) {
+        for (size_t c = 0; c < 4; c++) {
+            sensor->fit_a[r][c] = sensor->fit_a[r][c] * CALIBRATION_FIT_DECAY + row[r] * row[c];
+        }
+        sensor->fit_b[r] = sensor->fit_b[r] * CALIBRATION_FIT_DECAY + row[r] * value;
+    }
+    if (sensor->windows < CALIBRATION_MIN_WINDOWS) {
+        return;
+    }
+    double a[4][4];
+    double b[4];
+    double x[4];
+    memcpy(a, sensor->fit_a, sizeof(a));
+    memcpy(b, sensor->fit_b, sizeof(b));
+    // Pulls the components which the orientations can't tell apart to zero
+    for (size_t i = 0; i < 3; i++) {
+        a[i][i] += CALIBRATION_FIT_PRIOR;
+    }
+    if (!calibration_solve(a, b, x)) {
+        return;
+    }
+    double bias[3] = { x[0] * STANDARD_GRAVITY, x[1] * STANDARD_GRAVITY, x[2] * STANDARD_GRAVITY };
+    if (sqrt(bias[0] * bias[0] + bias[1] * bias[1] + bias[2] * bias[2]) > CALIBRATION_MAX_BIAS) {
+        return;
+    }
+    memcpy(sensor->bias, bias, sizeof(bias));
+    sensor->has_bias = true;
+}
+
+void calibration_update(calibration_t *calibration, size_t sensor_index, const accel_state_t *state) {
+    sensor_calibration_t *sensor = &calibration->sensors[sensor_index];
+    double *sample = sensor->window[sensor->window_len++];
+    sample[0] = state->x;
+    sample[1] = state->y;
+    sample[2] = state->z;
+    if (sensor->window_len < CALIBRATION_WINDOW) {
+        return;
+    }
+    sensor->window_len = 0;
+
+    double mean[3] = {0};
+    double variance[3] = {0};
+    for (size_t i = 0; i < CALIBRATION_WINDOW; i++) {
+        for (size_t k = 0; k < 3; k++) {
+            mean[k] += sensor->window[i][k] / CALIBRATION_WINDOW;
+        }
+    }
+    for (size_t i = 0; i < CALIBRATION_WINDOW; i++) {
+        for (size_t k = 0; k < 3; k++) {
+            double delta = sensor->window[i][k] - mean[k];
+            variance[k] += delta * delta / (CALIBRATION_WINDOW - 1);
+        }
+    }
+    // Motion or linear acceleration during the window
+    double max_variance = CALIBRATION_STATIONARY_STD * CALIBRATION_STATIONARY_STD;
+    if (variance[0] > max_variance || variance[1] > max_variance || variance[2] > max_variance) {
+        return;
+    }
+    double magnitude = sqrt(mean[0] * mean[0] + mean[1] * mean[1] + mean[2] * mean[2]);
+    if (fabs(magnitude - STANDARD_GRAVITY) > CALIBRATION_MAX_BIAS) {
+        return;
+    }
+
+    double noise = sqrt((variance[0] + variance[1] + variance[2]) / 3.0);
+    sensor->noise = sensor->has_noise ? sensor->noise + (noise - sensor->noise) * CALIBRATION_NOISE_WEIGHT : noise;
+    sensor->has_noise = true;
+    sensor->windows++;
+    calibration_fit(sensor, mean);
+    calibration->is_changed = true;
+}
+
+void calibration_apply(const calibration_t *calibration, size_t sensor_index, accel_state_t *state) {
+    const sensor_calibration_t *sensor = &calibration->sensors[sensor_index];
+    if (!sensor->has_bias) {
+        return;
+    }
+    state->x -= sensor->bias[0];
+    state->y -= sensor->bias[1];
+    state->z -= sensor->bias[2];
+}
+
+double calibration_get_gravity_threshold(const calibration_t *calibration, size_t sensor_index, double default_threshold) {
+    const sensor_calibration_t *sensor = &calibration->sensors[sensor_index];
+    if (!sensor->has_noise) {
+        return default_threshold;
+    }
+    // Angle noise of a projection r is noise / r radians
+    double threshold = sensor->noise / (CALIBRATION_MAX_ANGLE_NOISE * M_PI / 180.0);
+    if (threshold < CALIBRATION_MIN_GRAVITY_THRESHOLD) return CALIBRATION_MIN_GRAVITY_THRESHOLD;
+    if (threshold > CALIBRATION_MAX_GRAVITY_THRESHOLD) return CALIBRATION_MAX_GRAVITY_THRESHOLD;
+    return threshold;
+}
+
+double calibration_get_angle_noise(const calibration_t *calibration, size_t sensor_index, const accel_state_t *state) {
+    const sensor_calibration_t *sensor = &calibration->sensors[sensor_index];
+    if (!sensor->has_noise) {
+        return 0.0;
+    }
+    double projection = sqrt(state->x * state->x + state->z * state->z);
+    // Below the noise the angle is arbitrary
+    if (projection < sensor->noise) {
+        return 180.0;
+    }
+    return sensor->noise / projection * 180.0 / M_PI;
+}
+
+bool calibration_load(calibration_t *calibration, const char *path, char **error) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        make_errorf(error, "Cannot open the calibration file: %s, error: %s", path, strerror(errno));
+        return false;
+    }
+    calibration_t result;
+    calibration_init(&result, calibration->sensors_len);
+    char header[64];
+    size_t sensors_len = 0;
+    bool is_ok = fgets(header, sizeof(header), file) != NULL &&
+        strncmp(header, CALIBRATION_FILE_HEADER, strlen(CALIBRATION_FILE_HEADER)) == 0 &&
+        fscanf(file, " sensors %zu", &sensors_len) == 1;
+    if (is_ok && sensors_len != calibration->sensors_len) {
+        make_errorf(error, "Calibration file %s is for %zu sensors, the device has %zu", path, sensors_len, calibration->sensors_len);
+        fclose(file);
+        return false;
+    }
+    for (size_t i = 0; is_ok && i < sensors_len; i++) {
+        sensor_calibration_t *sensor = &result.sensors[i];
+        size_t index = 0;
+        unsigned long long windows = 0;
+        int has_noise = 0;
+        int has_bias = 0;
+        is_ok = fscanf(file, " sensor %zu %llu %d %lf %d %lf %lf %lf", &index, &windows, &has_noise, &sensor->noise,
+                       &has_bias, &sensor->bias[0], &sensor->bias[1], &sensor->bias[2]) == 8 && index == i;
+        for (size_t k = 0; is_ok && k < 16; k++) {
+            is_ok = fscanf(file, "%lf", &sensor->fit_a[k / 4][k % 4]) == 1;
+        }
+        for (size_t k = 0; is_ok && k < 4; k++) {
+            is_ok = fscanf(file, "%lf", &sensor->fit_b[k]) == 1;
+        }
+        sensor->windows = windows;
+        sensor->has_noise = has_noise != 0 && sensor->noise >= 0;
+        sensor->has_bias = has_bias != 0 &&
+            sqrt(sensor->bias[0] * sensor->bias[0] + sensor->bias[1] * sensor->bias[1] + sensor->bias[2] * sensor->bias[2]) <= CALIBRATION_MAX_BIAS;
+    }
+    fclose(file);
+    if (!is_ok) {
+        make_errorf(error, "Calibration file %s is malformed", path);
+        return false;
+    }
+    *calibration = result;
+    return true;
+}
+
+bool calibration_save(calibration_t *calibration, const char *path, char **error) {
+    char temp_path[PATH_MAX];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path)) {
+        make_errorf(error, "Calibration file path is too long: %s", path);
+        return false;
+    }
+    FILE *file = fopen(temp_path, "w");
+    if (file == NULL) {
+        make_errorf(error, "Cannot create the calibration file: %s, error: %s", path, strerror(errno));
+        return false;
+    }
+    fprintf(file, "%s\nsensors %zu\n", CALIBRATION_FILE_HEADER, calibration->sensors_len);
+    for (size_t i = 0; i < calibration->sensors_len; i++) {
+        const sensor_calibration_t *sensor = &calibration->sensors[i];
+        fprintf(file, "sensor %zu %llu %d %.17g %d %.17g %.17g %.17g", i, (unsigned long long)sensor->windows,
+                (int)sensor->has_noise, sensor->noise, (int)sensor->has_bias, sensor->bias[0], sensor->bias[1], sensor->bias[2]);
+        for (size_t k = 0; k < 16; k++) {
+            fprintf(file, " %.17g", sensor->fit_a[k / 4][k % 4]);
+        }
+        for (size_t k = 0; k < 4; k++) {
+            fprintf(file, " %.17g", sensor->fit_b[k]);
+        }
+        fprintf(file, "\n");
+    }
+    bool is_ok = !ferror(file);
+    is_ok = fclose(file) == 0 && is_ok;
+    if (!is_ok || rename(temp_path, path) != 0) {
+        make_errorf(error, "Cannot write the calibration file: %s, error: %s", path, strerror(errno));
+        remove(temp_path);
+        return false;
+    }
+    calibration->is_changed = false;
+    return true;
+}
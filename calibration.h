@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "device.h"
+
+// Samples of one sensor checked together for a stationary period
+#define CALIBRATION_WINDOW 4
+// The window is stationary if the standard deviation of every axis is below this (m/s^2)
+#define CALIBRATION_STATIONARY_STD 0.5
+// Weight of a new stationary window in the noise estimate
+#define CALIBRATION_NOISE_WEIGHT 0.2
+// Forgetting factor of the bias fit per stationary window, so the bias can drift slowly
+#define CALIBRATION_FIT_DECAY 0.995
+// Weight of the zero bias prior in the fit, in stationary windows. Axes which never changed
+// their orientation can't be fitted and keep zero bias
+#define CALIBRATION_FIT_PRIOR 1.0
+// Stationary windows needed before the bias is used
+#define CALIBRATION_MIN_WINDOWS 8
+// Larger offsets are considered a bad fit, also the limit for the magnitude of a stationary
+// window to differ from the gravity (m/s^2)
+#define CALIBRATION_MAX_BIAS 2.0
+// Gravity gate: the XZ projection must keep the standard deviation of the angle below this (degrees)
+#define CALIBRATION_MAX_ANGLE_NOISE 5.0
+#define CALIBRATION_MIN_GRAVITY_THRESHOLD 0.5
+#define CALIBRATION_MAX_GRAVITY_THRESHOLD 6.0
+// Hysteresis margin in standard deviations of the hinge angle, and its limit in degrees
+#define CALIBRATION_HYSTERESIS_SIGMAS 3.0
+#define CALIBRATION_MAX_HYSTERESIS 10.0
+
+// Online estimate of the accelerometer bias and noise floor from stationary periods.
+// The bias comes from a sphere fit of the stationary means: |a - bias|^2 = r^2 is linear in
+// (bias, r^2 - |bias|^2), the normal equations are accumulated in units of the standard
+// gravity with exponential forgetting.
+struct sensor_calibration_s {
+    bool has_noise;
+    double noise;           // m/s^2, standard deviation of one axis
+    bool has_bias;
+    double bias[3];         // m/s^2
+    uint64_t windows;       // stationary windows seen
+    double fit_a[4][4];
+    double fit_b[4];
+    size_t window_len;
+    double window[CALIBRATION_WINDOW][3];
+};
+
+typedef struct sensor_calibration_s sensor_calibration_t;
+
+struct calibration_s {
+    size_t sensors_len;
+    sensor_calibration_t sensors[DEVICE_MAX_SENSORS];
+    bool is_changed;        // since the last save
+};
+
+typedef struct calibration_s calibration_t;
+
+void calibration_init(calibration_t *calibration, size_t sensors_len);
+// Drops the collected windows. Used after gaps in the sampling
+void calibration_reset_windows(calibration_t *calibration);
+
+// Takes the raw sample of the sensor
+void calibration_update(calibration_t *calibration, size_t sensor, const accel_state_t *state);
+// Removes the bias from the sample
+void calibration_apply(const calibration_t *calibration, size_t sensor, accel_state_t *state);
+
+// XZ gravity projection required for a usable angle. default_threshold until the noise is known
+double calibration_get_gravity_threshold(const calibration_t *calibration, size_t sensor, double default_threshold);
+// Standard deviation of the XZ angle of the sample in degrees. 0 until the noise is known
+double calibration_get_angle_noise(const calibration_t *calibration, size_t sensor, const accel_state_t *state);
+
+// The file must match the number of sensors, otherwise calibration is left unchanged
+bool calibration_load(calibration_t *calibration, const char *path, char **error);
+// Written to a temporary file and renamed, so a crash doesn't leave a partial file
+bool calibration_save(calibration_t *calibration, const char *path, char **error);
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "config.h"
+#include "debug.h"
+
+#define CONFIG_MAX_LINE 256
+
+typedef enum config_type_e {
+    CONFIG_BOOL,
+    CONFIG_DOUBLE
+} config_type_t;
+
+struct config_key_s {
+    const char *name;
+    config_type_t type;
+    size_t offset;
+};
+
+static const struct config_key_s G_config_keys[] = {
+    { "debug", CONFIG_BOOL, offsetof(config_t, debug) },
+    { "poll_time", CONFIG_DOUBLE, offsetof(config_t, poll_time) },
+    { "idle_poll_time", CONFIG_DOUBLE, offsetof(config_t, idle_poll_time) },
+    { "tablet_angle", CONFIG_DOUBLE, offsetof(config_t, tablet_angle) },
+    { "laptop_angle", CONFIG_DOUBLE, offsetof(config_t, laptop_angle) },
+    { "closed_angle", CONFIG_DOUBLE, offsetof(config_t, closed_angle) },
+    { "idle_angle_delta", CONFIG_DOUBLE, offsetof(config_t, idle_angle_delta) },
+    { "idle_angle_margin", CONFIG_DOUBLE, offsetof(config_t, idle_angle_margin) },
+    { "calibration", CONFIG_BOOL, offsetof(config_t, calibration) },
+    { "fusion_time_constant", CONFIG_DOUBLE, offsetof(config_t, fusion.time_constant) },
+    { "fusion_max_linear_accel", CONFIG_DOUBLE, offsetof(config_t, fusion.max_linear_accel) },
+    { "gravity_threshold", CONFIG_DOUBLE, offsetof(config_t, fusion.gravity_threshold) }
+};
+
+void config_init(config_t *config) {
+    config->debug = false;
+    config->poll_time = 1.0;
+    config->idle_poll_time = 0.0;
+    config->tablet_angle = CONFIG_TABLET_ANGLE;
+    config->laptop_angle = CONFIG_LAPTOP_ANGLE;
+    config->closed_angle = CONFIG_CLOSED_ANGLE;
+    config->idle_angle_delta = CONFIG_IDLE_ANGLE_DELTA;
+    config->idle_angle_margin = CONFIG_IDLE_ANGLE_MARGIN;
+    config->calibration = true;
+    fusion_config_init(&config->fusion);
+}
+
+// Trims the whitespace in place
+static char *config_trim(char *str) {
+    while (isspace((unsigned char)*str)) str++;
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return str;
+}
+
+static bool config_parse_value(const struct config_key_s *key, const char *value, config_t *config) {
+    void *field = (char *)config + key->offset;
+    if (key->type == CONFIG_BOOL) {
+        if (strcmp(value, "true") == 0 || strcmp(value, "yes") == 0 || strcmp(value, "1") == 0) {
+            *(bool *)field = true;
+        } else if (strcmp(value, "false") == 0 || strcmp(value, "no") == 0 || strcmp(value, "0") == 0) {
+            *(bool *)field = false;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    char *end = NULL;
+    double number = strtod(value, &end);
+    if (end == value || *end != '\0') {
+        return false;
+    }
+    *(double *)field = number;
+    return true;
+}
+
+static bool config_validate(const config_t *config, char **error) {
+    if (config->poll_time <= 0 || config->idle_poll_time < 0) {
+        make_error(error, "Poll times must be positive");
+        return false;
+    }
+    if (!(config->closed_angle < config->laptop_angle && config->laptop_angle < config->tablet_angle && config->tablet_angle < 360.0)) {
+        make_error(error, "Angles must be ordered: closed_angle < laptop_angle < tablet_angle < 360");
+        return false;
+    }
+    if (config->fusion.time_constant <= 0 || config->fusion.max_linear_accel <= 0 || config->fusion.gravity_threshold < 0) {
+        make_error(error, "Fusion settings must be positive");
+        return false;
+    }
+    return true;
+}
+
+bool config_load(const char *path, config_t *config, char **error) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        make_errorf(error, "Cannot open the config file: %s, error: %s", path, strerror(errno));
+        return false;
+    }
+    // Parse into a copy, so a broken file doesn't leave a half applied config
+    config_t result = *config;
+    char line[CONFIG_MAX_LINE];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+        char *name = config_trim(line);
+        if (*name == '\0') continue;
+        char *separator = strchr(name, '=');
+        if (separator == NULL) {
+            make_errorf(error, "%s:%d: expected 'key = value'", path, line_number);
+            fclose(file);
+            return false;
+        }
+        *separator = '\0';
+        name = config_trim(name);
+        char *value = config_trim(separator + 1);
+        const struct config_key_s *key = NULL;
+        for (size_t i = 0; i < sizeof(G_config_keys) / sizeof(G_config_keys[0]); i++) {
+            if (strcmp(G_config_keys[i].name, name) == 0) {
+                key = &G_config_keys[i];
+                break;
+            }
+        }
+        if (key == NULL) {
+            make_errorf(error, "%s:%d: unknown key '%s'", path, line_number, name);
+            fclose(file);
+            return false;
+        }
+        if (!config_parse_value(key, value, &result)) {
+            make_errorf(error, "%s:%d: invalid value '%s' for '%s'", path, line_number, value, name);
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+    if (!config_validate(&result, error)) {
+        return false;
+    }
+    *config = result;
+    return true;
+}
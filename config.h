@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "fusion.h"
+
+// Default hinge angles in degrees, see config_t
+#define CONFIG_TABLET_ANGLE 300.0
+#define CONFIG_LAPTOP_ANGLE 180.0
+#define CONFIG_CLOSED_ANGLE 10.0
+// Power mode: the angle is considered stable if it changed less than this between samples
+#define CONFIG_IDLE_ANGLE_DELTA 5.0
+// Power mode: no transition is plausible if the angle is this far from all thresholds
+#define CONFIG_IDLE_ANGLE_MARGIN 30.0
+
+// Settings which can be changed at runtime. Loaded from a "key = value" file, '#' starts a comment.
+struct config_s {
+    bool debug;
+    double poll_time;         // seconds
+    double idle_poll_time;    // seconds, power mode poll time while the angle is stable. 0 is 4x poll_time
+    // Tablet mode is enabled when the hinge opens past tablet_angle or closes below closed_angle
+    // from the other side, and disabled when the angle is between closed_angle and laptop_angle
+    double tablet_angle;
+    double laptop_angle;
+    double closed_angle;
+    double idle_angle_delta;
+    double idle_angle_margin;
+    // Derive the gravity threshold and the hysteresis from the online sensor calibration
+    bool calibration;
+    fusion_config_t fusion;
+};
+
+typedef struct config_s config_t;
+
+void config_init(config_t *config);
+
+// Applies the values from the file on top of config. Either all values are applied or,
+// on any error, config is left unchanged.
+bool config_load(const char *path, config_t *config, char **error);
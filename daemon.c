@@ -1,39 +1,130 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <signal.h>
+#include <errno.h>
+#include <sys/prctl.h>
+#include <poll.h>
 
 #include "input.h"
 #include "device.h"
+#include "fusion.h"
+#include "config.h"
+#include "calibration.h"
+#include "stats.h"
+#include "sampler.h"
+#include "schedule.h"
 #include "devices/minibook_x.h"
 #include "devices/minibook_8.h"
+#include "devices/hinge.h"
+#include "devices/simulated.h"
+#include "simulator.h"
 #include "debug.h"
 
 #define VERSION "0.1.0"
 
+// Sensor and lid recovery: number of attempts and the backoff between them, doubled after each attempt
+#define RECOVERY_MAX_ATTEMPTS 8
+#define RECOVERY_INITIAL_BACKOFF 0.05
+#define RECOVERY_MAX_BACKOFF 2.0
+// CLOCK_BOOTTIME running ahead of CLOCK_MONOTONIC by more than this (seconds) means the system was suspended
+#define RESUME_THRESHOLD 1.0
+// Resolution of the ground truth in the simulation, seconds
+#define SIMULATION_TRUTH_STEP 0.001
+// Minimal time between the saves of a changed calibration, seconds
+#define CALIBRATION_SAVE_INTERVAL 600.0
+
 static const laptop_device_factory_t* G_all_devices[] = {
+  &device_hinge,
   &device_minibook_x,
   &device_minibook_8
 };
 
 static volatile bool G_is_running = false;
+static volatile sig_atomic_t G_is_reload_requested = false;
 
 typedef struct settings_s {
-    bool   debug;
-    double timeout;
+    // Values from the command line. The config file is applied on top of them
+    config_t config;
+    const char *config_path;
+    const char *calibration_path;
+    const char *root_path;
+    const char *scenario;   // run the simulation instead of the real devices
+    bool   threaded;
+    int    rt_priority;
+    int    cpu;
+    double coalesce;
 } settings_t;
 
+typedef struct daemon_stats_s {
+    stats_timer_t fusion;           // time spent in the calibration, fusion filters and hinge angles per tick
+    stats_timer_t decision_latency; // time from the first sample asking for a new mode to the switch
+    stats_timer_t sensor_read;      // time spent reading all sensors per tick
+    stats_timer_t sensor_skew;      // capture time difference between the sensors of a tick
+    stats_timer_t jitter;           // deviation of the sampling interval from the poll time
+    uint64_t main_wakeups;          // wakeups of the main thread in threaded mode
+    stats_timer_t recovery;         // time from a sensor or lid failure to the recovered device
+    uint64_t resumes;
+    stats_timer_t reload;           // time to load and apply the config file
+    uint64_t samples;
+    uint64_t rejected_samples;      // samples without usable gravity reference
+} daemon_stats_t;
+
+static daemon_stats_t G_stats = {0};
+
+typedef struct daemon_state_s {
+    config_t config;
+    laptop_device_t *device;
+    output_sink_t *sink;
+    int lid_switch_device;
+    bool is_lid_closed;
+    // Virtual switches, one for each distinct hinge output
+    size_t outputs_len;
+    uint16_t output_codes[INPUT_MAX_SWITCHES];
+    bool output_values[INPUT_MAX_SWITCHES];
+    // Time of the first sample which asked for the other value of the switch. Negative if none
+    double pending_since[INPUT_MAX_SWITCHES];
+    // Index of the output driven by the hinge
+    size_t hinge_outputs[DEVICE_MAX_HINGES];
+    // The hinge asks for tablet mode. Hysteresis state of tablet_mode_from_angle
+    bool is_hinge_folded[DEVICE_MAX_HINGES];
+    double last_angles[DEVICE_MAX_HINGES];
+    fusion_filter_t filters[DEVICE_MAX_SENSORS];
+    // Gyroscope integration of the samples read in the main thread
+    anglvel_integrator_t integrators[DEVICE_MAX_SENSORS];
+    calibration_t calibration;
+    double calibration_save_time;
+    double last_sample_time;
+    // No mode transition is plausible, the slow schedule can be used
+    bool is_idle;
+    // CLOCK_BOOTTIME - CLOCK_MONOTONIC at the last wakeup, grows during suspend
+    double suspend_time;
+} daemon_state_t;
+
+typedef bool (*recovery_action_t)(daemon_state_t *state, char **error);
+
 inline static int exit_with_error(char* error) {
+  debug_flush();
   fprintf(stderr, "%s\n", error);
-  free(error);
+  error_free(error);
   return EXIT_FAILURE;
 }
 
 // Print the help message
 inline static void print_help() {
-    printf("Usage: accel-tablet-moded [-f <time>] [-d|--debug] [-h|--help] [-v|--version]\n");
+    printf("Usage: accel-tablet-moded [-f <time>] [-c|--config <path>] [--calibration <path>] [-t|--threaded] [--rt-priority <n>] [--cpu <n>] [--coalesce <time>] [-r|--root <path>] [--simulate <scenario>] [-d|--debug] [-h|--help] [-v|--version]\n");
     printf("Options:\n");
     printf("  -f <time>: Poll time in seconds. Default is 1.0\n");
+    printf("  -c, --config <path>: Config file. Its values override the options and are reloaded on SIGHUP\n");
+    printf("  --calibration <path>: Keep the sensor bias and noise estimates in the file across restarts\n");
+    printf("  -t, --threaded: Read sensors in a dedicated sampling thread\n");
+    printf("  --rt-priority <n>: SCHED_FIFO priority of the sampling thread. Implies --threaded\n");
+    printf("  --cpu <n>: Pin the sampling thread to the CPU. Implies --threaded\n");
+    printf("  --coalesce <time>: Power mode. Align updates to the poll time grid with <time> seconds of timer slack\n");
+    printf("  -r, --root <path>: Read sysfs and IIO devices relative to <path>. The lid switch isn't used and the switch values are printed instead of uinput. For testing\n");
+    printf("  --simulate <scenario>: Run the scenario in virtual time without hardware and check the results:\n");
+    simulation_print_scenarios(stdout);
     printf("  -d, --debug: Enable debug mode\n");
     printf("  -h, --help: Print this help message\n");
     printf("  -v, --version: Print the version\n");
@@ -41,8 +132,15 @@ inline static void print_help() {
 
 // Parse the command line arguments
 inline static int parse_args(int argc, char *argv[], settings_t *settings) {
-    settings->debug = false;
-    settings->timeout = 1.0;
+    config_init(&settings->config);
+    settings->config_path = NULL;
+    settings->calibration_path = NULL;
+    settings->root_path = "";
+    settings->scenario = NULL;
+    settings->threaded = false;
+    settings->rt_priority = 0;
+    settings->cpu = -1;
+    settings->coalesce = 0.0;
     for (int i = 1; i < argc; i++) {
         if (strncmp(argv[i], "-f", 2) == 0) {
             char* value;
@@ -54,12 +152,52 @@ inline static int parse_args(int argc, char *argv[], settings_t *settings) {
                 fprintf(stderr, "Option -f doesn't have a value\n");
                 return EXIT_FAILURE;
             }
-            if (sscanf(value, "%lf", &settings->timeout) != 1) {
-                fprintf(stderr, "Value for option -f isn't float: %s\n", value);
+            if (sscanf(value, "%lf", &settings->config.poll_time) != 1 || settings->config.poll_time <= 0) {
+                fprintf(stderr, "Value for option -f isn't a positive float: %s\n", value);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--config") == 0 || strcmp(argv[i], "-c") == 0) {
+            if (i+1 >= argc) {
+                fprintf(stderr, "Option %s doesn't have a value\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            settings->config_path = argv[++i];
+        } else if (strcmp(argv[i], "--calibration") == 0) {
+            if (i+1 >= argc) {
+                fprintf(stderr, "Option %s doesn't have a value\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            settings->calibration_path = argv[++i];
+        } else if (strcmp(argv[i], "--simulate") == 0) {
+            if (i+1 >= argc) {
+                fprintf(stderr, "Option %s doesn't have a value\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            settings->scenario = argv[++i];
+        } else if (strcmp(argv[i], "--root") == 0 || strcmp(argv[i], "-r") == 0) {
+            if (i+1 >= argc) {
+                fprintf(stderr, "Option %s doesn't have a value\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            settings->root_path = argv[++i];
+        } else if (strcmp(argv[i], "--threaded") == 0 || strcmp(argv[i], "-t") == 0) {
+            settings->threaded = true;
+        } else if (strcmp(argv[i], "--rt-priority") == 0 || strcmp(argv[i], "--cpu") == 0) {
+            int *value = strcmp(argv[i], "--cpu") == 0 ? &settings->cpu : &settings->rt_priority;
+            if (i+1 >= argc || sscanf(argv[i+1], "%d", value) != 1 || *value < 0) {
+                fprintf(stderr, "Option %s requires a non-negative integer value\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            settings->threaded = true;
+            i++;
+        } else if (strcmp(argv[i], "--coalesce") == 0) {
+            if (i+1 >= argc || sscanf(argv[i+1], "%lf", &settings->coalesce) != 1 || settings->coalesce <= 0) {
+                fprintf(stderr, "Option %s requires a positive float value\n", argv[i]);
                 return EXIT_FAILURE;
             }
+            i++;
         } else if (strcmp(argv[i], "--debug") == 0 || strcmp(argv[i], "-d") == 0) {
-            settings->debug = true;
+            settings->config.debug = true;
         } else if (strcmp(argv[i], "--version") == 0 || strcmp(argv[i], "-v") == 0) {
             printf("%s\n", VERSION);
             return EXIT_SUCCESS;
@@ -85,25 +223,720 @@ inline static laptop_device_t* create_laptop_device(const laptop_device_factory_
     debug("Laptop model: %s\n", laptop_model);
     
     int model_len = strlen(laptop_model);
-    const laptop_device_factory_t* device_factory = NULL;
+    laptop_device_t *device = NULL;
+    char *create_error = NULL;
     for (size_t i = 0; i < devices_len; i++) {
-        if (devices[i]->is_current_device(laptop_model, model_len)) {
-            device_factory = devices[i];
+        if (!devices[i]->is_current_device(laptop_model, model_len)) {
+            continue;
+        }
+        error_free(create_error);
+        create_error = NULL;
+        if (devices[i]->create(&device, &create_error)) {
             break;
         }
+        // The next matching device is tried, e.g. the accelerometers if the hinge sensor fails
+        debug("Cannot create the device: %s\n", create_error);
+        device = NULL;
     }
-    if (device_factory == NULL) {
+    if (device != NULL) {
+        error_free(create_error);
+    } else if (create_error != NULL) {
+        *error = create_error;
+    } else {
         make_errorf(error, "Unsupported laptop model: %s", laptop_model);
-        free(laptop_model);
-        return NULL;
     }
     free(laptop_model);
+    return device;
+}
+
+// Returns the tablet mode requested by the angle between base and screen.
+// tablet_angle and laptop_angle are far apart already, closed_angle is used both ways, so
+// the angle must pass it by the margin (degrees) to change the mode.
+static inline bool tablet_mode_from_angle(const config_t *config, double angle, bool is_tablet_mode_enabled, double margin) {
+    if (!is_tablet_mode_enabled) {
+        return angle > config->tablet_angle || (angle < config->closed_angle - margin && angle > config->tablet_angle - 360.0);
+    }
+    return !(angle > config->closed_angle + margin && angle < config->laptop_angle);
+}
+
+// Hinge angle sensors report 0..360 degrees with 0 closed and don't wrap around, so a nearly
+// closed lid is laptop mode
+static inline bool tablet_mode_from_hinge_angle(const config_t *config, double angle, bool is_tablet_mode_enabled) {
+    if (!is_tablet_mode_enabled) {
+        return angle > config->tablet_angle;
+    }
+    return angle >= config->laptop_angle;
+}
+
+// Distance in degrees from the angle to the closest threshold of tablet_mode_from_angle
+static inline double tablet_mode_margin(const config_t *config, double angle) {
+    const double thresholds[] = {
+        config->tablet_angle - 360.0, config->closed_angle, config->laptop_angle, config->tablet_angle
+    };
+    double margin = fabs(angle - thresholds[0]);
+    for (size_t i = 1; i < sizeof(thresholds) / sizeof(double); i++) {
+        double distance = fabs(angle - thresholds[i]);
+        if (distance < margin) margin = distance;
+    }
+    return margin;
+}
+
+// Reports the switches which changed
+static bool set_outputs(daemon_state_t *state, const bool *values, char **error) {
+    uint16_t codes[INPUT_MAX_SWITCHES];
+    bool changed_values[INPUT_MAX_SWITCHES];
+    size_t len = 0;
+    for (size_t o = 0; o < state->outputs_len; o++) {
+        if (values[o] == state->output_values[o]) continue;
+        codes[len] = state->output_codes[o];
+        changed_values[len++] = values[o];
+    }
+    if (len == 0) {
+        return true;
+    }
+    if (!state->sink->set_values(state->sink, codes, changed_values, len, error)) {
+        return false;
+    }
+    for (size_t o = 0; o < state->outputs_len; o++) {
+        state->output_values[o] = values[o];
+    }
+    return true;
+}
+
+// Turns all switches off. Used while the lid is closed
+static bool reset_outputs(daemon_state_t *state, char **error) {
+    bool values[INPUT_MAX_SWITCHES] = {0};
+    for (size_t h = 0; h < state->device->layout.hinges_len; h++) {
+        state->is_hinge_folded[h] = false;
+    }
+    return set_outputs(state, values, error);
+}
+
+// One virtual switch for each distinct output of the hinges
+static bool init_outputs(daemon_state_t *state, char **error) {
+    const device_layout_t *layout = &state->device->layout;
+    state->outputs_len = 0;
+    for (size_t h = 0; h < layout->hinges_len; h++) {
+        size_t o = 0;
+        while (o < state->outputs_len && state->output_codes[o] != layout->hinge_output[h]) o++;
+        if (o == state->outputs_len) {
+            if (state->outputs_len >= INPUT_MAX_SWITCHES) {
+                make_errorf(error, "Too many switches, max %d", INPUT_MAX_SWITCHES);
+                return false;
+            }
+            state->output_codes[o] = layout->hinge_output[h];
+            state->output_values[o] = false;
+            state->outputs_len++;
+        }
+        state->hinge_outputs[h] = o;
+        state->is_hinge_folded[h] = false;
+        state->last_angles[h] = 0.0;
+    }
+    return true;
+}
+
+// Filters the sample and switches the outputs if needed
+static bool process_sample(daemon_state_t *state, sample_t *sample, char **error) {
+    const device_layout_t *layout = &state->device->layout;
+    const sensor_batch_t *batch = &sample->batch;
+    double sensor_angles[DEVICE_MAX_SENSORS] = {0};
+    bool has_gravity[DEVICE_MAX_SENSORS] = {0};
+    bool is_tracking[DEVICE_MAX_SENSORS] = {0};
+    double angle_noise[DEVICE_MAX_SENSORS] = {0};
+    double angles[DEVICE_MAX_HINGES];
+    bool is_present[DEVICE_MAX_HINGES];
+    bool requested[INPUT_MAX_SWITCHES] = {0};
+    bool values[INPUT_MAX_SWITCHES] = {0};
+    bool is_reliable = true;
+    bool is_idle = true;
+    
+    if (state->last_sample_time > 0) {
+        stats_timer_add(&G_stats.jitter, fabs(sample->time - state->last_sample_time - sample->period));
+    }
+    state->last_sample_time = sample->time;
+    stats_timer_add(&G_stats.sensor_read, sample->read_time);
+    if (batch->sensors_len > 1) {
+        stats_timer_add(&G_stats.sensor_skew, (double)sample->skew / 1000000000.0);
+    }
+    
+    // Get the angles from x, z. Gyroscope data (if any) keeps them valid during the motion
+    double fusion_start = stats_now();
+    for (size_t i = 0; i < batch->sensors_len; i++) {
+        accel_state_t accel;
+        if (!batch->is_present[i]) {
+            fusion_filter_reset(&state->filters[i]);
+            continue;
+        }
+        sensor_batch_get_state(batch, i, &accel);
+        // The gravity gate follows the noise floor of the sensor
+        fusion_config_t fusion = state->config.fusion;
+        if (state->config.calibration) {
+            calibration_update(&state->calibration, i, &accel);
+            calibration_apply(&state->calibration, i, &accel);
+            fusion.gravity_threshold = calibration_get_gravity_threshold(&state->calibration, i, fusion.gravity_threshold);
+            angle_noise[i] = calibration_get_angle_noise(&state->calibration, i, &accel);
+        }
+        sensor_angles[i] = fusion_filter_update(&state->filters[i], &fusion, &accel, accel.timestamp / 1000000000.0);
+        has_gravity[i] = accel_state_has_xz_gravity(&accel, fusion.gravity_threshold);
+        is_tracking[i] = fusion_filter_is_tracking(&state->filters[i]);
+    }
+    device_layout_get_hinge_angles(layout, batch, sensor_angles, angles, is_present);
+    stats_timer_add(&G_stats.fusion, stats_now() - fusion_start);
+    
+    for (size_t i = 0; i < batch->sensors_len; i++) {
+        debug("Sensor %zu: x:%lf y:%lf z:%lf angle:%lf\n", i, batch->x[i], batch->y[i], batch->z[i], sensor_angles[i]);
+    }
+    for (size_t h = 0; h < layout->hinges_len; h++) {
+        size_t o = state->hinge_outputs[h];
+        if (!is_present[h]) {
+            // Detached keyboard means tablet mode
+            state->is_hinge_folded[h] = true;
+            requested[o] = true;
+            values[o] = true;
+            debug("hinge %zu: detached\n", h);
+            continue;
+        }
+        uint8_t first = layout->hinge_first[h];
+        uint8_t second = layout->hinge_second[h];
+        bool is_hinge_reliable = layout->hinge_is_measured[h] || has_gravity[first] ||
+            (is_tracking[first] && is_tracking[second]);
+        // Hysteresis of a few standard deviations of the angle noise
+        double margin = 0.0;
+        if (!layout->hinge_is_measured[h]) {
+            margin = CALIBRATION_HYSTERESIS_SIGMAS *
+                sqrt(angle_noise[first] * angle_noise[first] + angle_noise[second] * angle_noise[second]);
+            margin = margin < CALIBRATION_MAX_HYSTERESIS ? margin : CALIBRATION_MAX_HYSTERESIS;
+        }
+        bool is_folded = layout->hinge_is_measured[h] ?
+            tablet_mode_from_hinge_angle(&state->config, angles[h], state->is_hinge_folded[h]) :
+            tablet_mode_from_angle(&state->config, angles[h], state->is_hinge_folded[h], margin);
+        is_idle = is_idle && is_hinge_reliable &&
+            fabs(angles[h] - state->last_angles[h]) < state->config.idle_angle_delta &&
+            tablet_mode_margin(&state->config, angles[h]) > state->config.idle_angle_margin;
+        state->last_angles[h] = angles[h];
+        requested[o] = requested[o] || is_folded;
+        if (is_hinge_reliable) {
+            state->is_hinge_folded[h] = is_folded;
+        } else {
+            is_reliable = false;
+        }
+        values[o] = values[o] || state->is_hinge_folded[h];
+        debug("hinge %zu: %lf margin:%lf\n", h, angles[h], margin);
+    }
+    
+    for (size_t o = 0; o < state->outputs_len; o++) {
+        if (requested[o] == state->output_values[o]) {
+            state->pending_since[o] = -1.0;
+        } else if (state->pending_since[o] < 0) {
+            state->pending_since[o] = sample->time;
+        }
+        is_idle = is_idle && state->pending_since[o] < 0;
+    }
+    state->is_idle = is_idle;
+    
+    G_stats.samples++;
+    if (!is_reliable) {
+        G_stats.rejected_samples++;
+    }
+    for (size_t o = 0; o < state->outputs_len; o++) {
+        if (values[o] != state->output_values[o] && state->pending_since[o] >= 0) {
+            stats_timer_add(&G_stats.decision_latency, sample->time - state->pending_since[o]);
+            state->pending_since[o] = -1.0;
+        }
+    }
+    if (!set_outputs(state, values, error)) {
+        return false;
+    }
+    
+    for (size_t o = 0; o < state->outputs_len; o++) {
+        debug("switch %u: %s\n", (unsigned int)state->output_codes[o], state->output_values[o] ? "true" : "false");
+    }
+    debug("\n");
+    return true;
+}
+
+static inline double get_suspend_time(void) {
+    struct timespec boottime, monotonic;
+    clock_gettime(CLOCK_BOOTTIME, &boottime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    return (double)(boottime.tv_sec - monotonic.tv_sec) + (double)(boottime.tv_nsec - monotonic.tv_nsec) / 1000000000.0;
+}
+
+// Forget the motion history. Used after gaps in the sampling
+static void reset_filters(daemon_state_t *state) {
+    for (size_t i = 0; i < DEVICE_MAX_SENSORS; i++) {
+        fusion_filter_reset(&state->filters[i]);
+        anglvel_integrator_reset(&state->integrators[i]);
+    }
+    for (size_t o = 0; o < INPUT_MAX_SWITCHES; o++) {
+        state->pending_since[o] = -1.0;
+    }
+    calibration_reset_windows(&state->calibration);
+    state->last_sample_time = -1.0;
+    state->is_idle = false;
+}
+
+// Restores the calibration of the previous runs. Without the file it starts from scratch
+static void load_calibration(const settings_t *settings, daemon_state_t *state) {
+    calibration_init(&state->calibration, state->device->layout.sensors_len);
+    state->calibration_save_time = stats_now();
+    if (settings->calibration_path == NULL) {
+        return;
+    }
+    char *load_error = NULL;
+    if (!calibration_load(&state->calibration, settings->calibration_path, &load_error)) {
+        debug("Calibration isn't loaded: %s\n", load_error);
+        error_free(load_error);
+        return;
+    }
+    debug("Calibration loaded from %s\n", settings->calibration_path);
+}
+
+// Saves the changed calibration at most once per CALIBRATION_SAVE_INTERVAL, unless forced
+static void save_calibration(const settings_t *settings, daemon_state_t *state, bool is_forced) {
+    if (settings->calibration_path == NULL || !state->calibration.is_changed) {
+        return;
+    }
+    double now = stats_now();
+    if (!is_forced && now - state->calibration_save_time < CALIBRATION_SAVE_INTERVAL) {
+        return;
+    }
+    state->calibration_save_time = now;
+    char *save_error = NULL;
+    if (!calibration_save(&state->calibration, settings->calibration_path, &save_error)) {
+        fprintf(stderr, "Calibration isn't saved: %s\n", save_error);
+        error_free(save_error);
+    }
+}
+
+static bool recover_sensors_action(daemon_state_t *state, char **error) {
+    return state->device->recover(state->device, error);
+}
+
+static bool recover_lid_switch_action(daemon_state_t *state, char **error) {
+    input_device_close(&state->lid_switch_device);
+    if (!input_device_open_named("Lid Switch", &state->lid_switch_device, error)) {
+        return false;
+    }
+    return input_device_lid_switch_get_state(state->lid_switch_device, &state->is_lid_closed, error);
+}
+
+// Retries the action with bounded backoff. Takes the error which caused the recovery.
+// The uinput device and the switch values are kept.
+static bool recover(const char *name, recovery_action_t action, daemon_state_t *state, char **error) {
+    debug("%s failed: %s\n", name, *error);
+    error_free(*error);
+    *error = NULL;
+    double started = stats_now();
+    double backoff = RECOVERY_INITIAL_BACKOFF;
+    for (int attempt = 1; attempt <= RECOVERY_MAX_ATTEMPTS && G_is_running; attempt++) {
+        if (action(state, error)) {
+            stats_timer_add(&G_stats.recovery, stats_now() - started);
+            debug("%s recovered, attempts: %d\n", name, attempt);
+            reset_filters(state);
+            return true;
+        }
+        debug("%s recovery attempt %d failed: %s\n", name, attempt, *error);
+        error_free(*error);
+        *error = NULL;
+        debug_flush();
+        struct timespec delay = {
+            .tv_sec = trunc(backoff),
+            .tv_nsec = trunc(fmod(backoff, 1.0) * 1000000000.0)
+        };
+        nanosleep(&delay, NULL);
+        backoff = backoff * 2 < RECOVERY_MAX_BACKOFF ? backoff * 2 : RECOVERY_MAX_BACKOFF;
+    }
+    if (G_is_running) {
+        make_errorf(error, "%s can't be recovered", name);
+    }
+    return false;
+}
+
+// Sampling is stopped while suspended. Lid state and motion history are stale after resume
+static bool check_resume(daemon_state_t *state, char **error) {
+    double suspend_time = get_suspend_time();
+    bool is_resumed = suspend_time - state->suspend_time > RESUME_THRESHOLD;
+    state->suspend_time = suspend_time;
+    if (!is_resumed) {
+        return true;
+    }
+    G_stats.resumes++;
+    debug("Resumed from suspend\n");
+    reset_filters(state);
+    if (!input_device_lid_switch_get_state(state->lid_switch_device, &state->is_lid_closed, error)) {
+        return recover("Lid switch", &recover_lid_switch_action, state, error);
+    }
+    return true;
+}
+
+// Loads the config file and swaps it in between ticks. Sensors, the lid switch, the uinput
+// device and the switch values are kept. A broken file is reported and the old config stays.
+static void reload_config(const settings_t *settings, daemon_state_t *state, schedule_t *schedule, sampler_t *sampler) {
+    G_is_reload_requested = false;
+    if (settings->config_path == NULL) {
+        debug("No config file to reload\n");
+        return;
+    }
+    double started = stats_now();
+    config_t config = settings->config;
+    char *load_error = NULL;
+    if (!config_load(settings->config_path, &config, &load_error)) {
+        fprintf(stderr, "Config isn't reloaded: %s\n", load_error);
+        error_free(load_error);
+        return;
+    }
+    bool is_period_changed = config.poll_time != state->config.poll_time ||
+        config.idle_poll_time != state->config.idle_poll_time;
+    // Keep the debug mode toggled by SIGUSR1 unless the file changes it
+    if (config.debug != state->config.debug) {
+        set_debug_mode_enabled(config.debug);
+    }
+    state->config = config;
+    if (is_period_changed) {
+        if (sampler != NULL) {
+            sampler_set_periods(sampler, config.poll_time, config.idle_poll_time);
+        } else {
+            schedule_set_periods(schedule, config.poll_time, config.idle_poll_time);
+        }
+        // The interval between the samples around the reload isn't a jitter
+        state->last_sample_time = -1.0;
+    }
+    stats_timer_add(&G_stats.reload, stats_now() - started);
+    debug("Config reloaded from %s\n", settings->config_path);
+}
+
+// Waits for the lid events or samples from the sampling thread. Lid failures return false
+static bool wait_for_events(int lid_switch_device, sampler_t *sampler, bool *is_lid_closed, char **error) {
+    struct pollfd pfds[2] = {
+        { .fd = lid_switch_device, .events = POLLIN, .revents = 0 },
+        { .fd = sampler->event_fd, .events = POLLIN, .revents = 0 }
+    };
+    if (ppoll(pfds, 2, NULL, NULL) < 0) {
+        // Interrupted by a signal. Caller decides whether to continue
+        if (errno == EINTR) {
+            return true;
+        }
+        make_errorf(error, "Poll error: %s", strerror(errno));
+        return false;
+    }
+    if (pfds[1].revents & POLLIN) {
+        sampler_clear_event(sampler);
+    }
+    // Removed or failed device doesn't set POLLIN, and would wake up the poll forever
+    if (pfds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        make_errorf(error, "Lid switch poll error, events: 0x%x", (unsigned int)pfds[0].revents);
+        return false;
+    }
+    if (pfds[0].revents & POLLIN) {
+        return input_device_lid_switch_drain(lid_switch_device, is_lid_closed, error);
+    }
+    return true;
+}
+
+// Waits for the next tick or a lid event, without the sampling thread. Lid failures return false
+static bool wait_for_tick(daemon_state_t *state, schedule_t *schedule, bool *is_tick, double *period, char **error) {
+    // In power mode nothing is sampled while the lid is closed, so wait for the lid only
+    struct timespec timeout = schedule_timeout(schedule);
+    bool is_waiting_lid = state->is_lid_closed && schedule_is_coalescing(schedule);
+    bool is_lid_ok = input_device_lid_switch_read(state->lid_switch_device, is_waiting_lid ? NULL : &timeout, &state->is_lid_closed, error);
+    *is_tick = schedule_wakeup(schedule);
+    if (*is_tick) {
+        *period = schedule_get_period(schedule, state->is_idle);
+        schedule_next(schedule, state->is_idle);
+    }
+    return is_lid_ok;
+}
+
+// Handles a wakeup of the main loop: failures, resume, reload and the samples. sampler is NULL
+// without the sampling thread, a sample is read on a tick or when the lid opens then.
+// Returns false if the daemon must stop
+static bool handle_wakeup(const settings_t *settings, daemon_state_t *state, schedule_t *schedule, sampler_t *sampler,
+                          bool is_lid_ok, bool was_lid_closed, bool is_tick, double *period, char **error) {
+    sample_t sample;
+    if (!is_lid_ok && !recover("Lid switch", &recover_lid_switch_action, state, error)) {
+        return false;
+    }
+    if (!G_is_running || !check_resume(state, error)) {
+        return false;
+    }
+    if (G_is_reload_requested) {
+        reload_config(settings, state, schedule, sampler);
+        *period = schedule_get_period(schedule, state->is_idle);
+    }
+    if (sampler != NULL) {
+        sampler_set_paused(sampler, state->is_lid_closed);
+    }
+    // Lid is closed, do nothing
+    if (state->is_lid_closed) {
+        if (!reset_outputs(state, error)) {
+            return false;
+        }
+        reset_filters(state);
+        if (sampler == NULL) {
+            return true;
+        }
+    }
     
+    if (sampler != NULL) {
+        bool is_ok = true;
+        bool is_sensor_failed = false;
+        // Samples queued around a lid transition may be taken at a nearly closed angle. The
+        // thread was paused while the lid was closed, so all of them are dropped
+        bool is_discarding = state->is_lid_closed || was_lid_closed;
+        while (is_ok && sampler_pop(sampler, &sample)) {
+            if (sample.error != NULL) {
+                *error = sample.error;
+                is_sensor_failed = true;
+                is_ok = false;
+            } else if (!is_discarding) {
+                is_ok = process_sample(state, &sample, error);
+            }
+        }
+        if (is_sensor_failed) {
+            // Sampling thread has stopped. Restart it with the recovered sensors
+            sampler_stop(sampler);
+            return recover("Sensors", &recover_sensors_action, state, error) &&
+                sampler_start(sampler, state->device, state->config.poll_time, state->config.idle_poll_time, settings->coalesce,
+                              settings->rt_priority, settings->cpu, error);
+        }
+        if (!is_ok) {
+            return false;
+        }
+        sampler_set_coarse(sampler, state->is_idle);
+        return true;
+    }
+    if (!is_tick && !was_lid_closed) {
+        return true;
+    }
+    if (!sampler_read(state->device, state->integrators, &sample, error)) {
+        return recover("Sensors", &recover_sensors_action, state, error);
+    }
+    // The simulation samples on the virtual clock of the schedule
+    if (schedule->virtual_now != NULL) {
+        sample.time = (double)*schedule->virtual_now / 1000000000.0;
+    }
+    sample.period = *period;
+    return process_sample(state, &sample, error);
+}
+
+static void print_stats(const daemon_stats_t *stats, const schedule_t *schedule) {
+    const input_stats_t *input_stats = input_device_get_stats();
+    debug("Samples: %llu, rejected: %llu\n",
+          (unsigned long long)stats->samples, (unsigned long long)stats->rejected_samples);
+    // No schedule in the simulation
+    if (schedule != NULL) {
+        debug("Sampling wakeups/s: %.3lf, deadline misses: %llu\n",
+              schedule_wakeups_per_second(schedule), (unsigned long long)schedule->misses);
+    }
+    if (schedule != NULL && stats->main_wakeups > 0) {
+        debug("Main thread wakeups/s: %.3lf\n",
+              (double)stats->main_wakeups * schedule_wakeups_per_second(schedule) / (double)schedule->wakeups);
+    }
+    debug("Lid events: %llu, syscalls: %llu\n",
+          (unsigned long long)input_stats->lid_events, (unsigned long long)input_stats->lid_syscalls);
+    debug("Mode switches: %llu, syscalls: %llu\n",
+          (unsigned long long)input_stats->switch_changes, (unsigned long long)input_stats->switch_syscalls);
+    stats_timer_print("Sampling jitter", &stats->jitter);
+    stats_timer_print("Sensor read", &stats->sensor_read);
+    stats_timer_print("Fusion", &stats->fusion);
+    stats_timer_print("Decision latency", &stats->decision_latency);
+    stats_timer_print("Sensor skew", &stats->sensor_skew);
+    debug("Resumes: %llu\n", (unsigned long long)stats->resumes);
+    stats_timer_print("Recovery", &stats->recovery);
+    stats_timer_print("Config reload", &stats->reload);
+}
+
+static void print_calibration(const calibration_t *calibration, const config_t *config) {
+    for (size_t i = 0; i < calibration->sensors_len; i++) {
+        const sensor_calibration_t *sensor = &calibration->sensors[i];
+        debug("Sensor %zu calibration: windows: %llu, noise: %.3lf, gravity threshold: %.2lf\n",
+              i, (unsigned long long)sensor->windows, sensor->noise,
+              calibration_get_gravity_threshold(calibration, i, config->fusion.gravity_threshold));
+        debug("Sensor %zu bias: %.3lf %.3lf %.3lf\n", i, sensor->bias[0], sensor->bias[1], sensor->bias[2]);
+    }
+}
+
+// Ground truth of the tablet mode at the current simulation time
+static bool simulation_truth(const daemon_state_t *state, simulation_t *simulation, bool is_tablet_mode) {
+    if (simulation_is_lid_closed(simulation)) {
+        return false;
+    }
+    // Detached keyboard means tablet mode
+    if (simulation_is_detached(simulation)) {
+        return true;
+    }
+    double angle = simulation_get_hinge_angle(simulation);
+    if (state->device->layout.hinge_is_measured[0]) {
+        return tablet_mode_from_hinge_angle(&state->config, angle, is_tablet_mode);
+    }
+    return tablet_mode_from_angle(&state->config, angle, is_tablet_mode, 0.0);
+}
+
+// Runs the pipeline with the simulated laptop, a scripted lid and a recording sink in virtual
+// time, as fast as possible. Switch events are compared with the ground truth of the script.
+static int run_simulation(const settings_t *settings) {
+    simulation_t simulation;
+    char *error = NULL;
+    if (!simulation_init(&simulation, settings->scenario, &error)) {
+        fprintf(stderr, "%s. Scenarios:\n", error);
+        error_free(error);
+        simulation_print_scenarios(stderr);
+        return EXIT_FAILURE;
+    }
+    device_simulated_set_simulation(&simulation);
     laptop_device_t *device = NULL;
-    if (!device_factory->create(&device, error)) {
-        return NULL;
+    if (!device_simulated.create(&device, &error)) {
+        return exit_with_error(error);
     }
-    return device;
+    daemon_state_t state = {
+        .config = settings->config,
+        .device = device,
+        .sink = &simulation.sink,
+        .lid_switch_device = -1,
+        .is_lid_closed = false,
+        .suspend_time = get_suspend_time()
+    };
+    reset_filters(&state);
+    load_calibration(settings, &state);
+    if (!init_outputs(&state, &error) ||
+        !simulation_open_lid(&simulation, &state.lid_switch_device, &error))
+    {
+        device->destroy(device);
+        return exit_with_error(error);
+    }
+    state.is_lid_closed = simulation.is_lid_closed;
+    // Lets recover() retry
+    G_is_running = true;
+    
+    // The daemon's schedule and wakeup handling without the sampling thread, on the virtual clock
+    int64_t now = 0;
+    schedule_t schedule;
+    schedule_init(&schedule, state.config.poll_time, state.config.idle_poll_time, settings->coalesce);
+    schedule_set_virtual_clock(&schedule, &now);
+    double period = schedule_get_period(&schedule, false);
+    double idle_period = schedule_get_period(&schedule, true);
+    
+    const simulation_scenario_t *scenario = simulation.scenario;
+    double duration = simulation_get_duration(&simulation);
+    bool truth = false;
+    double truth_time = -1.0;
+    size_t truth_changes = 0;
+    size_t events_seen = 0;
+    uint64_t ticks = 0;
+    stats_timer_t latency = {0};
+    double tick_period = period;
+    double anglvel_time = 0.0;
+    double started = stats_now();
+    bool is_ok = true;
+    
+    // Power mode may see the end of the script up to idle_period late
+    int64_t end_time = (int64_t)((duration + idle_period - period) * 1000000000.0);
+    int64_t truth_step = (int64_t)(SIMULATION_TRUTH_STEP * 1000000000.0);
+    while (now <= end_time) {
+        // Next step of the ground truth, or the deadline if it comes earlier
+        bool is_waiting_lid = state.is_lid_closed && schedule_is_coalescing(&schedule);
+        int64_t next = now + truth_step;
+        if (!is_waiting_lid && schedule.deadline < next) {
+            next = schedule.deadline > now ? schedule.deadline : now;
+        }
+        now = next;
+        double time = (double)now / 1000000000.0;
+        simulation_set_time(&simulation, time);
+        bool mode = simulation_truth(&state, &simulation, truth);
+        if (mode != truth) {
+            truth = mode;
+            truth_time = time;
+            truth_changes++;
+        }
+        // Gyroscope readings of the sampling thread between the ticks
+        if (settings->threaded && device->read_anglvel != NULL && !state.is_lid_closed &&
+            !(state.is_idle && schedule_is_coalescing(&schedule)) && time >= anglvel_time)
+        {
+            sampler_read_anglvel(device, state.integrators, NULL);
+            anglvel_time = time + DEVICE_ANGLVEL_PERIOD;
+        }
+        bool is_lid_event = false;
+        if (!simulation_update_lid(&simulation, &is_lid_event, &error)) {
+            is_ok = false;
+            break;
+        }
+        if (!is_lid_event && (is_waiting_lid || now < schedule.deadline)) {
+            continue;
+        }
+        
+        // Same wakeup as in the daemon. The sensors are unavailable while recover() retries
+        ticks++;
+        bool was_lid_closed = state.is_lid_closed;
+        bool is_tick = false;
+        double recovery_time = G_stats.recovery.total;
+        bool is_lid_ok = wait_for_tick(&state, &schedule, &is_tick, &tick_period, &error);
+        is_ok = handle_wakeup(settings, &state, &schedule, NULL, is_lid_ok, was_lid_closed, is_tick, &tick_period, &error);
+        now += (int64_t)((G_stats.recovery.total - recovery_time) * 1000000000.0);
+        debug_flush();
+        if (!is_ok) {
+            break;
+        }
+        // Latency from the ground truth transition to the switch event
+        for (; events_seen < simulation.events_len; events_seen++) {
+            const simulation_event_t *event = &simulation.events[events_seen];
+            debug("[%.3lf] switch %u: %s\n", event->time, (unsigned int)event->code, event->value ? "true" : "false");
+            if (truth_time >= 0 && event->value == truth) {
+                stats_timer_add(&latency, event->time - truth_time);
+            }
+        }
+    }
+    double elapsed = stats_now() - started;
+    print_stats(&G_stats, &schedule);
+    print_calibration(&state.calibration, &state.config);
+    debug_flush();
+    save_calibration(settings, &state, true);
+    input_device_close(&state.lid_switch_device);
+    simulation_close_lid(&simulation);
+    device_layout_t layout = device->layout;
+    device->destroy(device);
+    if (!is_ok) {
+        return exit_with_error(error);
+    }
+    
+    // In power mode a fold from a stable pose is seen at the next idle tick, up to idle_period
+    // after the last one instead of period
+    double max_latency = scenario->max_latency * period + (idle_period - period);
+    bool is_passed = simulation.events_len == scenario->expected_toggles &&
+        (latency.count == 0 || latency.max <= max_latency);
+    printf("Scenario: %s (%s)\n", scenario->name, scenario->description);
+    printf("Virtual time: %.1lf s, ticks: %llu, real time: %.3lf ms\n",
+           duration, (unsigned long long)ticks, elapsed * 1000.0);
+    printf("Switch events: %zu (expected %zu), ground truth changes: %zu\n",
+           simulation.events_len, scenario->expected_toggles, truth_changes);
+    if (latency.count > 0) {
+        printf("Fold-to-switch latency: avg %.1lf ms, max %.1lf ms (limit %.1lf ms)\n",
+               latency.total / (double)latency.count * 1000.0, latency.max * 1000.0, max_latency * 1000.0);
+    }
+    printf("Samples: %llu, rejected: %llu\n",
+           (unsigned long long)G_stats.samples, (unsigned long long)G_stats.rejected_samples);
+    if (G_stats.fusion.count > 0) {
+        printf("Per sample: %zu sensors, %zu hinges, read %.2lf us, fusion and hinges %.2lf us\n",
+               layout.sensors_len, layout.hinges_len,
+               G_stats.sensor_read.total / (double)G_stats.sensor_read.count * 1000000.0,
+               G_stats.fusion.total / (double)G_stats.fusion.count * 1000000.0);
+    }
+    if (G_stats.recovery.count > 0) {
+        printf("Recoveries: %llu, avg %.1lf ms, max %.1lf ms\n", (unsigned long long)G_stats.recovery.count,
+               G_stats.recovery.total / (double)G_stats.recovery.count * 1000.0, G_stats.recovery.max * 1000.0);
+    }
+    for (size_t i = 0; state.config.calibration && i < state.calibration.sensors_len; i++) {
+        printf("Sensor %zu: noise %.3lf m/s^2, gravity threshold %.2lf m/s^2\n", i, state.calibration.sensors[i].noise,
+               calibration_get_gravity_threshold(&state.calibration, i, state.config.fusion.gravity_threshold));
+    }
+    // Known to fail with the fixed gravity threshold. It may still pass if the few accepted
+    // samples happen to fall right, so neither result is an error
+    if (scenario->needs_calibration && !state.config.calibration) {
+        printf("%s\n", is_passed ? "XPASS" : "XFAIL");
+        return EXIT_SUCCESS;
+    }
+    printf("%s\n", is_passed ? "PASS" : "FAIL");
+    return is_passed ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 // Signal handler
@@ -113,6 +946,18 @@ static void sigint_handler(int signum) {
     G_is_running = false;
 }
 
+__attribute__((noinline))
+static void sighup_handler(int signum) {
+    (void)(signum);
+    G_is_reload_requested = true;
+}
+
+__attribute__((noinline))
+static void sigusr1_handler(int signum) {
+    (void)(signum);
+    toggle_debug_mode();
+}
+
 // Main
 int main(int argc, char *argv[]) {
     // Parse the command line arguments
@@ -121,110 +966,118 @@ int main(int argc, char *argv[]) {
     if (arg_result >= 0) {
         return arg_result;
     }
-    set_debug_mode_enabled(settings.debug);
-    
     char *error = NULL;
-    
-    // Create virtual switch device
-    int switch_device = -1;
-    if (!input_device_tablet_switch_create(&switch_device, &error)) {
+    if (settings.config_path != NULL && !config_load(settings.config_path, &settings.config, &error)) {
         return exit_with_error(error);
     }
-
+    set_debug_mode_enabled(settings.config.debug);
+    device_set_root_path(settings.root_path);
+    if (settings.scenario != NULL) {
+        return run_simulation(&settings);
+    }
+    
     // Register the signal handler
     signal(SIGINT, sigint_handler);
+    // Service managers stop the daemon with SIGTERM
+    signal(SIGTERM, sigint_handler);
+    signal(SIGUSR1, sigusr1_handler);
+    signal(SIGHUP, sighup_handler);
 
-    // Open lid switch device for polling
+    // Open lid switch device for polling. A test root has no input devices, the lid stays open
     int lid_switch_device = -1;
-    if (!input_device_open_named("Lid Switch", &lid_switch_device, &error)) {
-        input_device_tablet_switch_destroy(&switch_device);
+    bool has_input_devices = settings.root_path[0] == '\0';
+    if (has_input_devices && !input_device_open_named("Lid Switch", &lid_switch_device, &error)) {
         return exit_with_error(error);
     }
     
     size_t devices_len = sizeof(G_all_devices) / sizeof(laptop_device_factory_t*);
     laptop_device_t *device = create_laptop_device(G_all_devices, devices_len, &error);
     if (device == NULL) {
-        input_device_tablet_switch_destroy(&switch_device);
         input_device_close(&lid_switch_device);
         return exit_with_error(error);
     }
     
-    bool is_tablet_mode_enabled = false;
-    bool is_lid_closed = false;
-    accel_state_t screen_state;
-    accel_state_t base_state;
+    daemon_state_t state = {
+        .config = settings.config,
+        .device = device,
+        .sink = NULL,
+        .lid_switch_device = lid_switch_device,
+        .is_lid_closed = false,
+        .suspend_time = get_suspend_time()
+    };
+    reset_filters(&state);
+    load_calibration(&settings, &state);
+    
+    // Create virtual switch device with the switches of the hinges.
+    // The lid can be closed already
+    if (!init_outputs(&state, &error) ||
+        !(has_input_devices ? input_device_switch_sink_create(state.output_codes, state.outputs_len, &state.sink, &error) :
+                              input_device_print_sink_create(&state.sink, &error)) ||
+        !input_device_lid_switch_get_state(state.lid_switch_device, &state.is_lid_closed, &error))
+    {
+        if (state.sink != NULL) state.sink->destroy(state.sink);
+        input_device_close(&state.lid_switch_device);
+        device->destroy(device);
+        return exit_with_error(error);
+    }
+    debug("Lid is %s\n", state.is_lid_closed ? "closed" : "open");
     
     G_is_running = true;
     error = NULL;
     
-    struct timespec timeout = {
-        .tv_sec = trunc(settings.timeout),
-        .tv_nsec = trunc(fmod(settings.timeout, 1.0) * 1000000000.0)
-    };
+    // Timer slack lets the kernel merge our wakeups with others. Inherited by the sampling thread
+    if (settings.coalesce > 0 && prctl(PR_SET_TIMERSLACK, (unsigned long)(settings.coalesce * 1000000000.0), 0, 0, 0) != 0) {
+        debug("Can't set the timer slack: %s\n", strerror(errno));
+    }
+    
+    schedule_t schedule;
+    schedule_init(&schedule, state.config.poll_time, state.config.idle_poll_time, settings.coalesce);
+    double period = schedule_get_period(&schedule, false);
+    
+    if (device->read_anglvel != NULL && !settings.threaded && state.config.poll_time > DEVICE_ANGLVEL_MAX_STEP) {
+        debug("The gyroscope is read only at the samples, it is used with --threaded or a poll time up to %.2lf s\n",
+              DEVICE_ANGLVEL_MAX_STEP);
+    }
+    sampler_t sampler = { .event_fd = -1 };
+    if (settings.threaded &&
+        !sampler_start(&sampler, device, state.config.poll_time, state.config.idle_poll_time, settings.coalesce,
+                       settings.rt_priority, settings.cpu, &error))
+    {
+        G_is_running = false;
+    }
     
     while (G_is_running) {
-        if (!input_device_lid_switch_read(lid_switch_device, timeout, &is_lid_closed, &error)) {
-            break;
-        }
-        if (is_tablet_mode_enabled && is_lid_closed) {
-            if (!input_device_tablet_switch_set_mode(switch_device, false, &error)) {
-                break;
-            }
-            is_tablet_mode_enabled = false;
-        }
-        // Lid is closed, do nothing
-        if (is_lid_closed) continue;
-        
-        // Lid is open. Calculate angle
-        if (!device->read_screen_accel(device, &screen_state, &error)) {
-            break;
-        }
-        if (!device->read_base_accel(device, &base_state, &error)) {
-            break;
-        }
-        debug("Screen: x:%lf y:%lf z:%lf\n", screen_state.x, screen_state.y, screen_state.z);
-        debug("Base  : x:%lf y:%lf z:%lf\n", base_state.x, base_state.y, base_state.z);
-
-        // Get the angle from x, z
-        double angle_screen = accel_state_get_xz_angle(&screen_state);
-        double angle_base = accel_state_get_xz_angle(&base_state);
-        double angle = angle_base - angle_screen;
-
-        if (angle < 0 && angle_base < 0 && angle_screen > 0) {
-            angle += 360.0;
+        // Print the log of the previous iteration before blocking
+        debug_flush();
+        save_calibration(&settings, &state, false);
+        bool was_lid_closed = state.is_lid_closed;
+        bool is_tick = false;
+        bool is_lid_ok = true;
+        if (settings.threaded) {
+            is_lid_ok = wait_for_events(state.lid_switch_device, &sampler, &state.is_lid_closed, &error);
+            G_stats.main_wakeups++;
+        } else {
+            is_lid_ok = wait_for_tick(&state, &schedule, &is_tick, &period, &error);
         }
-
-        if (screen_state.x > 3.0 || screen_state.x < -3.0 ||
-            screen_state.z > 3.0 || screen_state.z < -3.0)
+        if (!handle_wakeup(&settings, &state, &schedule, settings.threaded ? &sampler : NULL,
+                           is_lid_ok, was_lid_closed, is_tick, &period, &error))
         {
-            if (360 - angle < 60 && angle > 0 && !is_tablet_mode_enabled) {
-                if (!input_device_tablet_switch_set_mode(switch_device, true, &error)) {
-                    break;
-                }
-                is_tablet_mode_enabled = true;
-            } else if (angle < 10 && angle > -60 && !is_tablet_mode_enabled) {
-                if (!input_device_tablet_switch_set_mode(switch_device, true, &error)) {
-                    break;
-                }
-                is_tablet_mode_enabled = true;
-            } else if (angle > 10 && angle < 180 && is_tablet_mode_enabled) {
-                if (!input_device_tablet_switch_set_mode(switch_device, false, &error)) {
-                    break;
-                }
-                is_tablet_mode_enabled = false;
-            }
+            break;
         }
-        
-        debug("angle_screen: %lf\n", angle_screen);
-        debug("angle_base: %lf\n", angle_base);
-        debug("diff: %lf\n", angle);
-        debug("tablet_mode: %s\n\n", is_tablet_mode_enabled ? "true" : "false");
     }
     
     G_is_running = false;
+    sampler_stop(&sampler);
+    if (settings.threaded) {
+        debug("Dropped samples: %llu\n", (unsigned long long)atomic_load(&sampler.dropped));
+    }
+    print_stats(&G_stats, settings.threaded ? &sampler.schedule : &schedule);
+    print_calibration(&state.calibration, &state.config);
+    debug_flush();
+    save_calibration(&settings, &state, true);
     
-    input_device_tablet_switch_destroy(&switch_device);
-    input_device_close(&lid_switch_device);
+    state.sink->destroy(state.sink);
+    input_device_close(&state.lid_switch_device);
     device->destroy(device);
     
     if (error != NULL) {
@@ -1,23 +1,330 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <signal.h>
 #include "debug.h"
 
-static volatile bool G_is_debug = false;
+#define LOG_RING_SIZE 256
+#define LOG_MAX_ARGS 6
+// Room for the longest error message and a few short strings, so recovery errors aren't cut
+#define LOG_STRINGS_SIZE (MAX_ERROR_STR_SIZE + 1 + 96)
+#define LOG_SPEC_SIZE 32
+
+typedef enum log_arg_type_e {
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER
+} log_arg_type_t;
+
+// Length modifier of an integer conversion
+typedef enum log_length_e {
+    LOG_LENGTH_NONE,
+    LOG_LENGTH_CHAR,        // hh
+    LOG_LENGTH_SHORT,       // h
+    LOG_LENGTH_LONG,        // l
+    LOG_LENGTH_LONG_LONG,   // ll
+    LOG_LENGTH_SIZE,        // z
+    LOG_LENGTH_INTMAX,      // j
+    LOG_LENGTH_PTRDIFF      // t
+} log_length_t;
+
+typedef union log_arg_u {
+    long long i;
+    unsigned long long u;
+    double d;
+    size_t str_offset;  // into log_record_t.strings
+    const void *p;
+} log_arg_t;
+
+// Fixed size binary record. %s arguments are copied into strings, the rest is stored as is.
+typedef struct log_record_s {
+    atomic_size_t sequence;
+    int64_t timestamp;
+    const char *fmt;
+    uint8_t argc;
+    log_arg_t args[LOG_MAX_ARGS];
+    char strings[LOG_STRINGS_SIZE];
+} log_record_t;
+
+static volatile sig_atomic_t G_is_debug = false;
+
+// Bounded multi-producer queue: producers are the main and the sampling threads, consumer is debug_flush()
+static log_record_t G_log_ring[LOG_RING_SIZE];
+static atomic_size_t G_log_head = 0;
+static atomic_size_t G_log_tail = 0;
+static atomic_bool G_log_is_initialized = false;
+static atomic_uint_fast64_t G_log_dropped = 0;
+
+static char G_error_pool[ERROR_POOL_SIZE][MAX_ERROR_STR_SIZE+1];
+static atomic_bool G_error_pool_used[ERROR_POOL_SIZE];
+// Returned when all slots are taken. Never written and never freed
+static char G_error_pool_exhausted[] = "Error pool exhausted";
+
+char *error_alloc(void) {
+    for (size_t i = 0; i < ERROR_POOL_SIZE; i++) {
+        if (!atomic_exchange_explicit(&G_error_pool_used[i], true, memory_order_acquire)) {
+            return G_error_pool[i];
+        }
+    }
+    return G_error_pool_exhausted;
+}
+
+size_t error_capacity(const char *error) {
+    return error == G_error_pool_exhausted ? 0 : MAX_ERROR_STR_SIZE + 1;
+}
+
+void error_free(char *error) {
+    if (error == NULL) return;
+    for (size_t i = 0; i < ERROR_POOL_SIZE; i++) {
+        if (error == G_error_pool[i]) {
+            atomic_store_explicit(&G_error_pool_used[i], false, memory_order_release);
+            return;
+        }
+    }
+}
 
 bool is_debug_mode_enabled(void) {
     return G_is_debug;
 }
 
+static void log_init(void) {
+    if (atomic_load_explicit(&G_log_is_initialized, memory_order_acquire)) return;
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_init(&G_log_ring[i].sequence, i);
+    }
+    atomic_store_explicit(&G_log_is_initialized, true, memory_order_release);
+}
+
+// Called from the main thread before any other thread is started
 void set_debug_mode_enabled(bool is_enabled) {
+    log_init();
     G_is_debug = is_enabled;
 }
 
+void toggle_debug_mode(void) {
+    G_is_debug = !G_is_debug;
+}
+
+// Parses the conversion spec starting after '%'. Returns the pointer after the spec.
+static const char *log_parse_spec(const char *fmt, char *conversion, log_length_t *length) {
+    *length = LOG_LENGTH_NONE;
+    while (*fmt && strchr("-+ #0123456789.", *fmt)) fmt++;
+    while (*fmt && strchr("hlzjt", *fmt)) {
+        switch (*fmt) {
+        case 'h': *length = *length == LOG_LENGTH_SHORT ? LOG_LENGTH_CHAR : LOG_LENGTH_SHORT; break;
+        case 'l': *length = *length == LOG_LENGTH_LONG ? LOG_LENGTH_LONG_LONG : LOG_LENGTH_LONG; break;
+        case 'z': *length = LOG_LENGTH_SIZE; break;
+        case 'j': *length = LOG_LENGTH_INTMAX; break;
+        case 't': *length = LOG_LENGTH_PTRDIFF; break;
+        }
+        fmt++;
+    }
+    *conversion = *fmt;
+    return *fmt ? fmt + 1 : fmt;
+}
+
+static inline log_arg_type_t log_arg_type(char conversion) {
+    switch (conversion) {
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        return LOG_ARG_DOUBLE;
+    case 's':
+        return LOG_ARG_STRING;
+    case 'p':
+        return LOG_ARG_POINTER;
+    case 'u': case 'x': case 'X': case 'o':
+        return LOG_ARG_UINT;
+    default:
+        return LOG_ARG_INT;
+    }
+}
+
+// Takes the argument with the type of the length modifier, like printf would
+static inline long long log_arg_get_int(va_list *args, log_length_t length) {
+    switch (length) {
+    case LOG_LENGTH_CHAR: return (signed char)va_arg(*args, int);
+    case LOG_LENGTH_SHORT: return (short)va_arg(*args, int);
+    case LOG_LENGTH_LONG: return va_arg(*args, long);
+    case LOG_LENGTH_LONG_LONG: return va_arg(*args, long long);
+    case LOG_LENGTH_SIZE: return va_arg(*args, ssize_t);
+    case LOG_LENGTH_INTMAX: return va_arg(*args, intmax_t);
+    case LOG_LENGTH_PTRDIFF: return va_arg(*args, ptrdiff_t);
+    default: return va_arg(*args, int);
+    }
+}
+
+static inline unsigned long long log_arg_get_uint(va_list *args, log_length_t length) {
+    switch (length) {
+    case LOG_LENGTH_CHAR: return (unsigned char)va_arg(*args, unsigned int);
+    case LOG_LENGTH_SHORT: return (unsigned short)va_arg(*args, unsigned int);
+    case LOG_LENGTH_LONG: return va_arg(*args, unsigned long);
+    case LOG_LENGTH_LONG_LONG: return va_arg(*args, unsigned long long);
+    case LOG_LENGTH_SIZE: return va_arg(*args, size_t);
+    case LOG_LENGTH_INTMAX: return va_arg(*args, uintmax_t);
+    case LOG_LENGTH_PTRDIFF: return (size_t)va_arg(*args, ptrdiff_t);
+    default: return va_arg(*args, unsigned int);
+    }
+}
+
+static void log_record_fill(log_record_t *record, const char *fmt, va_list *args) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    record->timestamp = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    record->fmt = fmt;
+    record->argc = 0;
+    size_t strings_len = 0;
+    for (const char *p = fmt; *p && record->argc < LOG_MAX_ARGS; ) {
+        if (*p++ != '%') continue;
+        if (*p == '%') { p++; continue; }
+        char conversion;
+        log_length_t length;
+        p = log_parse_spec(p, &conversion, &length);
+        log_arg_t *arg = &record->args[record->argc++];
+        switch (log_arg_type(conversion)) {
+        case LOG_ARG_DOUBLE:
+            arg->d = va_arg(*args, double);
+            break;
+        case LOG_ARG_POINTER:
+            arg->p = va_arg(*args, const void *);
+            break;
+        case LOG_ARG_STRING: {
+            // Copy with truncation. The last byte of strings is always left for the empty string
+            const char *str = va_arg(*args, const char *);
+            // Printed like glibc printf does, and never passed to memcpy
+            if (str == NULL) str = "(null)";
+            size_t len = strnlen(str, LOG_STRINGS_SIZE - 1 - strings_len);
+            arg->str_offset = strings_len;
+            memcpy(record->strings + strings_len, str, len);
+            record->strings[strings_len + len] = '\0';
+            strings_len += len + 1;
+            if (strings_len > LOG_STRINGS_SIZE - 1) strings_len = LOG_STRINGS_SIZE - 1;
+            break;
+        }
+        case LOG_ARG_INT:
+            arg->i = log_arg_get_int(args, length);
+            break;
+        case LOG_ARG_UINT:
+            arg->u = log_arg_get_uint(args, length);
+            break;
+        }
+    }
+}
+
 void debug(const char *fmt, ...) {
-    if (G_is_debug) {
-        va_list args;
-        va_start(args, fmt);
-        vprintf(fmt, args);
-        va_end(args);
+    if (!G_is_debug) return;
+    size_t head = atomic_load_explicit(&G_log_head, memory_order_relaxed);
+    log_record_t *record;
+    for (;;) {
+        record = &G_log_ring[head % LOG_RING_SIZE];
+        size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        if (sequence == head) {
+            if (atomic_compare_exchange_weak_explicit(&G_log_head, &head, head + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (sequence < head) {
+            // Ring is full
+            atomic_fetch_add_explicit(&G_log_dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            head = atomic_load_explicit(&G_log_head, memory_order_relaxed);
+        }
+    }
+    va_list args;
+    va_start(args, fmt);
+    log_record_fill(record, fmt, &args);
+    va_end(args);
+    atomic_store_explicit(&record->sequence, head + 1, memory_order_release);
+}
+
+static void log_record_print(const log_record_t *record) {
+    char spec[LOG_SPEC_SIZE];
+    uint8_t argi = 0;
+    printf("[%lld.%06lld] ", (long long)(record->timestamp / 1000000000), (long long)(record->timestamp % 1000000000 / 1000));
+    for (const char *p = record->fmt; *p; ) {
+        if (*p != '%') {
+            putchar(*p++);
+            continue;
+        }
+        if (p[1] == '%') {
+            putchar('%');
+            p += 2;
+            continue;
+        }
+        char conversion;
+        log_length_t length;
+        const char *end = log_parse_spec(p + 1, &conversion, &length);
+        size_t spec_len = (size_t)(end - p) < LOG_SPEC_SIZE - 3 ? (size_t)(end - p) : LOG_SPEC_SIZE - 3;
+        p = end;
+        if (argi >= record->argc) {
+            continue;
+        }
+        const log_arg_t *arg = &record->args[argi++];
+        // Flags, width and precision without the length modifiers
+        size_t flags_len = 0;
+        for (const char *f = end - spec_len; f < end - 1 && flags_len < spec_len; f++) {
+            if (!strchr("hlzjt", *f)) spec[flags_len++] = *f;
+        }
+        spec[flags_len] = conversion;
+        spec[flags_len + 1] = '\0';
+        switch (log_arg_type(conversion)) {
+        case LOG_ARG_DOUBLE:
+            printf(spec, arg->d);
+            break;
+        case LOG_ARG_POINTER:
+            printf(spec, arg->p);
+            break;
+        case LOG_ARG_STRING:
+            printf(spec, record->strings + arg->str_offset);
+            break;
+        case LOG_ARG_INT:
+            if (conversion == 'c') {
+                printf(spec, (int)arg->i);
+                break;
+            }
+            // Print every integer as long long
+            spec[flags_len] = 'l';
+            spec[flags_len + 1] = 'l';
+            spec[flags_len + 2] = conversion;
+            spec[flags_len + 3] = '\0';
+            printf(spec, arg->i);
+            break;
+        case LOG_ARG_UINT:
+            spec[flags_len] = 'l';
+            spec[flags_len + 1] = 'l';
+            spec[flags_len + 2] = conversion;
+            spec[flags_len + 3] = '\0';
+            printf(spec, arg->u);
+            break;
+        }
     }
 }
 
+void debug_flush(void) {
+    if (!atomic_load_explicit(&G_log_is_initialized, memory_order_acquire)) return;
+    size_t tail = atomic_load_explicit(&G_log_tail, memory_order_relaxed);
+    bool has_output = false;
+    for (;;) {
+        log_record_t *record = &G_log_ring[tail % LOG_RING_SIZE];
+        if (atomic_load_explicit(&record->sequence, memory_order_acquire) != tail + 1) {
+            break;
+        }
+        log_record_print(record);
+        atomic_store_explicit(&record->sequence, tail + LOG_RING_SIZE, memory_order_release);
+        tail++;
+        has_output = true;
+    }
+    atomic_store_explicit(&G_log_tail, tail, memory_order_relaxed);
+    uint64_t dropped = atomic_exchange_explicit(&G_log_dropped, 0, memory_order_relaxed);
+    if (dropped > 0) {
+        printf("Log ring overflow, %llu messages dropped\n", (unsigned long long)dropped);
+        has_output = true;
+    }
+    if (has_output) {
+        fflush(stdout);
+    }
+}
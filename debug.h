@@ -1,25 +1,43 @@
 #pragma once
 
+#include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 
 #define MAX_ERROR_STR_SIZE 2048
+// Number of error strings which can be alive at the same time
+#define ERROR_POOL_SIZE 8
 
-#define make_error(error, str)             \
-do {                                       \
-  size_t len = strlen(str)+1;              \
-  *error = (char *)malloc(len);            \
-  strncpy(*error, str, len);               \
+// Both macros do nothing if error is NULL (caller isn't interested in the message).
+// Strings come from a preallocated pool and must be released with error_free().
+#define make_error(error, str)                              \
+do {                                                        \
+  if ((error) == NULL) break;                               \
+  *(error) = error_alloc();                                 \
+  snprintf(*(error), error_capacity(*(error)), "%s", str);  \
 } while (0)
 
 #define make_errorf(error, fmt, ...)                        \
 do {                                                        \
-  *error = (char *)malloc(MAX_ERROR_STR_SIZE+1);            \
-  snprintf(*error, MAX_ERROR_STR_SIZE+1, fmt, __VA_ARGS__); \
-  *error[MAX_ERROR_STR_SIZE] = '\0';                         \
+  if ((error) == NULL) break;                               \
+  *(error) = error_alloc();                                 \
+  snprintf(*(error), error_capacity(*(error)), fmt, __VA_ARGS__); \
 } while (0)
 
+// Never fails. If the pool is exhausted a fixed "Error pool exhausted" string is returned,
+// it has no capacity, so the message isn't written, and error_free() ignores it.
+char *error_alloc(void);
+// Bytes which can be written to the string, including the terminating zero
+size_t error_capacity(const char *error);
+void error_free(char *error);
+
 bool is_debug_mode_enabled(void);
 void set_debug_mode_enabled(bool is_enabled);
+// Async-signal-safe
+void toggle_debug_mode(void);
 
+// Records the message into the log ring. Formatting is deferred to debug_flush().
+// Supports d, i, u, x, X, o, c, f, e, g, s and p conversions with hh, h, l, ll, z, j and t modifiers.
 void debug(const char *fmt, ...);
+// Formats and prints the recorded messages. Call it off the time critical path.
+void debug_flush(void);
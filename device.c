@@ -4,33 +4,95 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/stat.h>
 
 #include "device.h"
 #include "debug.h"
 
 #define DEVICE_MAX_PATH 256
-#define IIO_DEVICE_PATH "/sys/bus/iio/devices/iio:device%u"
+#define IIO_DEVICES_DIR "%s/sys/bus/iio/devices"
+#define IIO_DEVICE_PATH IIO_DEVICES_DIR"/iio:device%u"
+#define IIO_DEVICE_NAME_PATH IIO_DEVICE_PATH"/name"
+#define IIO_DEVICE_CHRDEV_PATH "%s/dev/iio:device%u"
+#define DMI_PRODUCT_NAME_PATH "%s/sys/devices/virtual/dmi/id/product_name"
 #define IIO_ACCEL_SCALE_PATH IIO_DEVICE_PATH"/in_accel_scale"
 #define IIO_ACCEL_VALUE_PATH IIO_DEVICE_PATH"/in_accel_%c_raw"
+#define IIO_ANGLVEL_SCALE_PATH IIO_DEVICE_PATH"/in_anglvel_scale"
+#define IIO_ANGLVEL_VALUE_PATH IIO_DEVICE_PATH"/in_anglvel_%c_raw"
+#define IIO_CHANNEL_PATH IIO_DEVICE_PATH"/%s_%s"
+#define IIO_SCAN_ELEMENT_PATH IIO_DEVICE_PATH"/scan_elements/%s_%s"
+#define IIO_BUFFER_PATH IIO_DEVICE_PATH"/buffer/%s"
+#define IIO_HINGE_CHANNEL "in_angl0"
+#define IIO_HINGE_SCALE_PATH IIO_DEVICE_PATH"/in_angl_scale"
+#define IIO_HINGE_OFFSET_PATH IIO_DEVICE_PATH"/in_angl_offset"
+#define IIO_BUFFER_LENGTH 16
+#define IIO_TRIGGER_PATH IIO_DEVICE_PATH"/trigger/current_trigger"
+#define IIO_TIMESTAMP_CLOCK_PATH IIO_DEVICE_PATH"/current_timestamp_clock"
+#define IIO_SYSFS_TRIGGER_PATH IIO_DEVICES_DIR"/iio_sysfs_trigger/%s"
+#define IIO_SYSFS_TRIGGER_NAME "sysfstrig%u"
+#define IIO_TRIGGER_NOW_PATH IIO_DEVICES_DIR"/%s/trigger_now"
+// Base for the sysfs trigger id, so it doesn't clash with triggers created by others
+#define IIO_SYSFS_TRIGGER_ID_BASE 4700
+// Consecutive ids tried for the sysfs trigger
+#define IIO_SYSFS_TRIGGER_PROBES 16
+// How long to wait for the triggered scan to reach the buffer
+#define IIO_TRIGGER_WAIT_MS 100
 
-static bool iio_device_accel_open_axis(uint8_t device_id, char axis, int *fd, char **error) {
+// Prefix for all sysfs and IIO character device paths. Allows to run against a fake tree.
+static const char *G_root_path = "";
+
+void device_set_root_path(const char *path) {
+    G_root_path = path;
+}
+
+const char *device_get_root_path(void) {
+    return G_root_path;
+}
+
+static bool iio_device_open_axis(const char *path_fmt, uint8_t device_id, char axis, int *fd, char **error) {
     char path[DEVICE_MAX_PATH] = {0};
-    if (snprintf(path, DEVICE_MAX_PATH, IIO_ACCEL_VALUE_PATH, (unsigned int)device_id, axis) <= 0) {
-        make_errorf(error, "Can't build iio accel value path for device: %u, axis: %c", (unsigned int)device_id, axis);
+    if (snprintf(path, DEVICE_MAX_PATH, path_fmt, G_root_path, (unsigned int)device_id, axis) <= 0) {
+        make_errorf(error, "Can't build iio value path for device: %u, axis: %c", (unsigned int)device_id, axis);
         return false;
     }
     *fd = open(path, O_RDONLY);
-    if (*fd <= 0) {
-        make_errorf(error, "Cannot open the accel value: %s, error: %s", path, strerror(errno));
+    if (*fd < 0) {
+        make_errorf(error, "Cannot open the iio value: %s, error: %s", path, strerror(errno));
         return false;
     }
     return true;
 }
 
+static bool iio_device_has_channel(const char *path_fmt, uint8_t device_id, char axis) {
+    struct stat st;
+    char path[DEVICE_MAX_PATH] = {0};
+    if (snprintf(path, DEVICE_MAX_PATH, path_fmt, G_root_path, (unsigned int)device_id, axis) <= 0) {
+        return false;
+    }
+    return stat(path, &st) == 0;
+}
+
+static void iio_device_anglvel_open(uint8_t device_id, accel_device_t *device);
+static void iio_device_anglvel_close(accel_device_t *device);
+
+static inline int64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static inline bool iio_read_double_value(int fd, char buffer[20], double *value) {
     // read string value of accelerometer
-    size_t len = read(fd, buffer, 19);
+    ssize_t len = read(fd, buffer, 19);
     // len should be greater than 0
     if (len <= 0) {
         return false;
@@ -47,7 +109,7 @@ static inline bool iio_read_double_value(int fd, char buffer[20], double *value)
 bool iio_device_is_available(uint8_t device_id) {
     struct stat st;
     char path[DEVICE_MAX_PATH] = {0};
-    if (snprintf(path, DEVICE_MAX_PATH, IIO_DEVICE_PATH, (unsigned int)device_id) <= 0) {
+    if (snprintf(path, DEVICE_MAX_PATH, IIO_DEVICE_PATH, G_root_path, (unsigned int)device_id) <= 0) {
         return false;
     }
     return stat(path, &st) == 0;
@@ -56,7 +118,7 @@ bool iio_device_is_available(uint8_t device_id) {
 bool iio_device_get_i2c_port(uint8_t device_id, uint8_t *port, char** error) {
     char path[DEVICE_MAX_PATH] = {0};
     char buffer[DEVICE_MAX_PATH] = {0};
-    if (snprintf(path, DEVICE_MAX_PATH, IIO_DEVICE_PATH, (unsigned int)device_id) <= 0) {
+    if (snprintf(path, DEVICE_MAX_PATH, IIO_DEVICE_PATH, G_root_path, (unsigned int)device_id) <= 0) {
         make_error(error, "Can't sprint device path");
         return false;
     }
@@ -82,52 +144,104 @@ bool iio_device_get_i2c_port(uint8_t device_id, uint8_t *port, char** error) {
 }
 
 bool iio_device_accel_open(uint8_t device_id, accel_device_t *device, char** error) {
+    device->device_id = device_id;
+    device->fd_buffer = -1;
+    device->is_realtime_timestamp = false;
+    device->is_trigger_owned = false;
+    device->timestamp_clock[0] = '\0';
+    device->samples_len = 0;
+    // Closing a partially opened device is safe
+    device->fd_x = device->fd_y = device->fd_z = -1;
+    device->fd_anglvel_x = device->fd_anglvel_y = device->fd_anglvel_z = -1;
+    device->has_anglvel = false;
     if (!iio_device_accel_read_scale(device_id, &device->scale, error)) {
         return false;
     }
-    if (!iio_device_accel_open_axis(device_id, 'x', &device->fd_x, error)) {
+    if (!iio_device_open_axis(IIO_ACCEL_VALUE_PATH, device_id, 'x', &device->fd_x, error) ||
+        !iio_device_open_axis(IIO_ACCEL_VALUE_PATH, device_id, 'y', &device->fd_y, error) ||
+        !iio_device_open_axis(IIO_ACCEL_VALUE_PATH, device_id, 'z', &device->fd_z, error))
+    {
+        iio_device_accel_close(device);
         return false;
     }
-    if (!iio_device_accel_open_axis(device_id, 'y', &device->fd_y, error)) {
-        close(device->fd_x);
-        return false;
+    iio_device_anglvel_open(device_id, device);
+    return true;
+}
+
+// Gyroscope is optional. Failures are logged and the device works as accelerometer only.
+static void iio_device_anglvel_open(uint8_t device_id, accel_device_t *device) {
+    char *error = NULL;
+    device->has_anglvel = false;
+    device->fd_anglvel_x = device->fd_anglvel_y = device->fd_anglvel_z = -1;
+    if (!iio_device_has_channel(IIO_ANGLVEL_VALUE_PATH, device_id, 'y')) {
+        return;
     }
-    if (!iio_device_accel_open_axis(device_id, 'z', &device->fd_z, error)) {
-        close(device->fd_x);
-        close(device->fd_y);
-        return false;
+    if (!iio_device_anglvel_read_scale(device_id, &device->anglvel_scale, &error)) {
+        goto failed;
     }
-    return true;
+    if (!iio_device_open_axis(IIO_ANGLVEL_VALUE_PATH, device_id, 'x', &device->fd_anglvel_x, &error)) {
+        goto failed;
+    }
+    if (!iio_device_open_axis(IIO_ANGLVEL_VALUE_PATH, device_id, 'y', &device->fd_anglvel_y, &error)) {
+        goto failed;
+    }
+    if (!iio_device_open_axis(IIO_ANGLVEL_VALUE_PATH, device_id, 'z', &device->fd_anglvel_z, &error)) {
+        goto failed;
+    }
+    debug("Gyroscope found for device: %u\n", (unsigned int)device_id);
+    device->has_anglvel = true;
+    return;
+failed:
+    debug("Gyroscope disabled for device %u: %s\n", (unsigned int)device_id, error);
+    error_free(error);
+    iio_device_anglvel_close(device);
+}
+
+static void iio_device_anglvel_close(accel_device_t *device) {
+    if (device->fd_anglvel_x >= 0) close(device->fd_anglvel_x);
+    if (device->fd_anglvel_y >= 0) close(device->fd_anglvel_y);
+    if (device->fd_anglvel_z >= 0) close(device->fd_anglvel_z);
+    device->fd_anglvel_x = device->fd_anglvel_y = device->fd_anglvel_z = -1;
+    device->has_anglvel = false;
 }
 
 void iio_device_accel_close(accel_device_t *device) {
-    close(device->fd_x);
-    close(device->fd_y);
-    close(device->fd_z);
+    if (device->fd_x >= 0) close(device->fd_x);
+    if (device->fd_y >= 0) close(device->fd_y);
+    if (device->fd_z >= 0) close(device->fd_z);
     device->fd_x = device->fd_y = device->fd_z = -1;
+    iio_device_anglvel_close(device);
 }
 
-bool iio_device_accel_read_scale(uint8_t device_id, double *scale, char **error) {
+static bool iio_device_read_scale(const char *path_fmt, uint8_t device_id, double *scale, char **error) {
     char path[DEVICE_MAX_PATH] = {0};
     char value_buffer[20] = {0};
-    if (snprintf(path, DEVICE_MAX_PATH, IIO_ACCEL_SCALE_PATH, (unsigned int)device_id) <= 0) {
-        make_errorf(error, "Can't build iio accel scale path for device: %u", (unsigned int)device_id);
+    if (snprintf(path, DEVICE_MAX_PATH, path_fmt, G_root_path, (unsigned int)device_id) <= 0) {
+        make_errorf(error, "Can't build iio scale path for device: %u", (unsigned int)device_id);
         return false;
     }
     int fd = open(path, O_RDONLY);
     if (fd <= 0) {
-        make_errorf(error, "Cannot open the accel scale: %s, error: %s", path, strerror(errno));
+        make_errorf(error, "Cannot open the scale: %s, error: %s", path, strerror(errno));
         return false;
     }
     bool success = iio_read_double_value(fd, value_buffer, scale);
     close(fd);
     if (!success) {
-        make_errorf(error, "Cannot read the accel scale from: %s", path);
+        make_errorf(error, "Cannot read the scale from: %s", path);
         return false;
     }
     return true;
 }
 
+bool iio_device_accel_read_scale(uint8_t device_id, double *scale, char **error) {
+    return iio_device_read_scale(IIO_ACCEL_SCALE_PATH, device_id, scale, error);
+}
+
+bool iio_device_anglvel_read_scale(uint8_t device_id, double *scale, char **error) {
+    return iio_device_read_scale(IIO_ANGLVEL_SCALE_PATH, device_id, scale, error);
+}
+
 bool iio_device_accel_read_state(const accel_device_t *device, accel_state_t *state, char **error) {
     char value_buffer[20] = {0};
     if (!iio_read_double_value(device->fd_x, value_buffer, &state->x)) {
@@ -143,11 +257,907 @@ bool iio_device_accel_read_state(const accel_device_t *device, accel_state_t *st
         return false;
     }
     accel_state_apply_scale(state, device->scale);
+    state->timestamp = monotonic_ns();
+    state->has_anglvel = device->has_anglvel;
+    state->xz_angle_delta = 0.0;
+    if (!device->has_anglvel) {
+        return true;
+    }
+    return iio_device_accel_read_anglvel(device, state, error);
+}
+
+bool iio_device_accel_read_anglvel(const accel_device_t *device, accel_state_t *state, char **error) {
+    char value_buffer[20] = {0};
+    state->timestamp = monotonic_ns();
+    if (!iio_read_double_value(device->fd_anglvel_x, value_buffer, &state->anglvel.x)) {
+        make_error(error, "Cannot read the anglvel value for axis x");
+        return false;
+    }
+    if (!iio_read_double_value(device->fd_anglvel_y, value_buffer, &state->anglvel.y)) {
+        make_error(error, "Cannot read the anglvel value for axis y");
+        return false;
+    }
+    if (!iio_read_double_value(device->fd_anglvel_z, value_buffer, &state->anglvel.z)) {
+        make_error(error, "Cannot read the anglvel value for axis z");
+        return false;
+    }
+    anglvel_state_apply_scale(&state->anglvel, device->anglvel_scale);
+    state->has_anglvel = true;
+    return true;
+}
+
+// errno is kept on failure, so the callers can tell the errors apart
+static bool iio_write_string(const char *path, const char *value, char **error) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        int open_errno = errno;
+        make_errorf(error, "Cannot open %s for writing, error: %s", path, strerror(open_errno));
+        errno = open_errno;
+        return false;
+    }
+    size_t len = strlen(value);
+    bool success = write(fd, value, len) == (ssize_t)len;
+    int write_errno = errno;
+    close(fd);
+    if (!success) {
+        make_errorf(error, "Cannot write '%s' to %s, error: %s", value, path, strerror(write_errno));
+        errno = write_errno;
+        return false;
+    }
+    return true;
+}
+
+// Reads a short attribute without the trailing newline. Empty if it can't be read
+static void iio_read_string(const char *path, char *buffer, size_t size) {
+    buffer[0] = '\0';
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    ssize_t len = read(fd, buffer, size - 1);
+    close(fd);
+    buffer[len > 0 ? len : 0] = '\0';
+    buffer[strcspn(buffer, "\n")] = '\0';
+}
+
+// Another process (iio-sensor-proxy) may capture from the device. Its buffer and trigger are left alone
+static bool iio_device_check_capture_free(uint8_t device_id, char **error) {
+    char path[DEVICE_MAX_PATH] = {0};
+    char value[64];
+    snprintf(path, DEVICE_MAX_PATH, IIO_BUFFER_PATH, G_root_path, (unsigned int)device_id, "enable");
+    iio_read_string(path, value, sizeof(value));
+    if (strcmp(value, "1") == 0) {
+        make_errorf(error, "Buffer of IIO device %u is already enabled", (unsigned int)device_id);
+        return false;
+    }
+    snprintf(path, DEVICE_MAX_PATH, IIO_TRIGGER_PATH, G_root_path, (unsigned int)device_id);
+    iio_read_string(path, value, sizeof(value));
+    if (value[0] != '\0') {
+        make_errorf(error, "IIO device %u already uses the trigger %s", (unsigned int)device_id, value);
+        return false;
+    }
+    return true;
+}
+
+bool iio_device_find_by_name(const char *name, uint8_t *device_id) {
+    char path[DEVICE_MAX_PATH] = {0};
+    snprintf(path, DEVICE_MAX_PATH, IIO_DEVICES_DIR, G_root_path);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return false;
+    }
+    bool found = false;
+    struct dirent *entry;
+    while (!found && (entry = readdir(dir)) != NULL) {
+        unsigned int id = 0;
+        if (sscanf(entry->d_name, "iio:device%u", &id) != 1 || id > UINT8_MAX) {
+            continue;
+        }
+        char buffer[DEVICE_MAX_PATH] = {0};
+        snprintf(path, DEVICE_MAX_PATH, IIO_DEVICE_NAME_PATH, G_root_path, id);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        ssize_t len = read(fd, buffer, sizeof(buffer)-1);
+        close(fd);
+        if (len <= 0) {
+            continue;
+        }
+        buffer[len] = '\0';
+        buffer[strcspn(buffer, "\n")] = '\0';
+        if (strcmp(buffer, name) == 0) {
+            *device_id = (uint8_t)id;
+            found = true;
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+bool iio_device_channel_read_scan_type(uint8_t device_id, const char *channel, iio_scan_type_t *type, char **error) {
+    char path[DEVICE_MAX_PATH] = {0};
+    char buffer[32] = {0};
+    snprintf(path, DEVICE_MAX_PATH, IIO_SCAN_ELEMENT_PATH, G_root_path, (unsigned int)device_id, channel, "type");
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        make_errorf(error, "Cannot open the scan type: %s, error: %s", path, strerror(errno));
+        return false;
+    }
+    ssize_t len = read(fd, buffer, sizeof(buffer)-1);
+    close(fd);
+    if (len <= 0) {
+        make_errorf(error, "Cannot read the scan type from: %s", path);
+        return false;
+    }
+    buffer[len] = '\0';
+    // Format is [be|le]:[s|u]bits/storagebits[Xrepeat]>>shift
+    char endianness = 0, sign = 0;
+    unsigned int bits = 0, storage_bits = 0, shift = 0;
+    char *shift_str = strstr(buffer, ">>");
+    if (sscanf(buffer, "%ce:%c%u/%u", &endianness, &sign, &bits, &storage_bits) != 4 ||
+        shift_str == NULL || sscanf(shift_str, ">>%u", &shift) != 1 ||
+        bits == 0 || bits > 64 || storage_bits % 8 != 0 || storage_bits == 0 || storage_bits > 64)
+    {
+        make_errorf(error, "Unsupported scan type '%s' in %s", buffer, path);
+        return false;
+    }
+    type->is_big_endian = endianness == 'b';
+    type->is_signed = sign == 's';
+    type->bits = (uint8_t)bits;
+    type->storage_bits = (uint8_t)storage_bits;
+    type->shift = (uint8_t)shift;
+    return true;
+}
+
+bool iio_device_channel_set_scan_enabled(uint8_t device_id, const char *channel, bool enabled, char **error) {
+    char path[DEVICE_MAX_PATH] = {0};
+    snprintf(path, DEVICE_MAX_PATH, IIO_SCAN_ELEMENT_PATH, G_root_path, (unsigned int)device_id, channel, "en");
+    return iio_write_string(path, enabled ? "1" : "0", error);
+}
+
+bool iio_device_buffer_set_enabled(uint8_t device_id, bool enabled, unsigned int length, char **error) {
+    char path[DEVICE_MAX_PATH] = {0};
+    char value[16] = {0};
+    if (enabled) {
+        snprintf(path, DEVICE_MAX_PATH, IIO_BUFFER_PATH, G_root_path, (unsigned int)device_id, "length");
+        snprintf(value, sizeof(value), "%u", length);
+        if (!iio_write_string(path, value, error)) {
+            return false;
+        }
+    }
+    snprintf(path, DEVICE_MAX_PATH, IIO_BUFFER_PATH, G_root_path, (unsigned int)device_id, "enable");
+    return iio_write_string(path, enabled ? "1" : "0", error);
+}
+
+bool iio_device_buffer_open(uint8_t device_id, int *fd, char **error) {
+    char path[DEVICE_MAX_PATH] = {0};
+    snprintf(path, DEVICE_MAX_PATH, IIO_DEVICE_CHRDEV_PATH, G_root_path, (unsigned int)device_id);
+    *fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (*fd < 0) {
+        make_errorf(error, "Cannot open the iio buffer: %s, error: %s", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+int64_t iio_scan_type_decode(const iio_scan_type_t *type, const uint8_t *data) {
+    size_t bytes = type->storage_bits / 8;
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        size_t index = type->is_big_endian ? i : bytes - 1 - i;
+        value = (value << 8) | data[index];
+    }
+    value >>= type->shift;
+    if (type->bits < 64) {
+        value &= (UINT64_C(1) << type->bits) - 1;
+        if (type->is_signed && (value & (UINT64_C(1) << (type->bits - 1)))) {
+            value |= ~((UINT64_C(1) << type->bits) - 1);
+        }
+    }
+    return (int64_t)value;
+}
+
+static bool iio_device_channel_read_scan_index(uint8_t device_id, const char *channel, int *index, char **error) {
+    char path[DEVICE_MAX_PATH] = {0};
+    char buffer[20] = {0};
+    double value = 0.0;
+    snprintf(path, DEVICE_MAX_PATH, IIO_SCAN_ELEMENT_PATH, G_root_path, (unsigned int)device_id, channel, "index");
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        make_errorf(error, "Cannot open the scan index: %s, error: %s", path, strerror(errno));
+        return false;
+    }
+    bool success = iio_read_double_value(fd, buffer, &value);
+    close(fd);
+    if (!success) {
+        make_errorf(error, "Cannot read the scan index from: %s", path);
+        return false;
+    }
+    *index = (int)value;
+    return true;
+}
+
+// Finds the trigger directory (triggerN) by the trigger name
+static bool iio_trigger_find_dir(const char *name, char *dir_name, size_t dir_name_len) {
+    char path[DEVICE_MAX_PATH] = {0};
+    snprintf(path, DEVICE_MAX_PATH, IIO_DEVICES_DIR, G_root_path);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return false;
+    }
+    bool found = false;
+    struct dirent *entry;
+    while (!found && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "trigger", 7) != 0) {
+            continue;
+        }
+        char buffer[64] = {0};
+        if (snprintf(path, DEVICE_MAX_PATH, IIO_DEVICES_DIR"/%s/name", G_root_path, entry->d_name) >= DEVICE_MAX_PATH) {
+            continue;
+        }
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        ssize_t len = read(fd, buffer, sizeof(buffer)-1);
+        close(fd);
+        if (len <= 0) {
+            continue;
+        }
+        buffer[len] = '\0';
+        buffer[strcspn(buffer, "\n")] = '\0';
+        if (strcmp(buffer, name) == 0) {
+            found = snprintf(dir_name, dir_name_len, "%s", entry->d_name) < (int)dir_name_len;
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+bool iio_trigger_open(iio_trigger_t *trigger, char **error) {
+    char path[DEVICE_MAX_PATH] = {0};
+    char value[16] = {0};
+    char name[32] = {0};
+    char dir_name[64] = {0};
+    unsigned int first_id = IIO_SYSFS_TRIGGER_ID_BASE + (unsigned int)getpid() % 1000;
+    bool is_added = false;
+    trigger->fd_trigger_now = -1;
+    // echo <id> > /sys/bus/iio/devices/iio_sysfs_trigger/add_trigger
+    snprintf(path, DEVICE_MAX_PATH, IIO_SYSFS_TRIGGER_PATH, G_root_path, "add_trigger");
+    for (unsigned int i = 0; i < IIO_SYSFS_TRIGGER_PROBES && !is_added; i++) {
+        trigger->id = first_id + i;
+        snprintf(name, sizeof(name), IIO_SYSFS_TRIGGER_NAME, trigger->id);
+        // Id is taken by another process
+        if (iio_trigger_find_dir(name, dir_name, sizeof(dir_name))) {
+            continue;
+        }
+        snprintf(value, sizeof(value), "%u", trigger->id);
+        is_added = iio_write_string(path, value, NULL);
+        // The kernel rejects an existing id with EINVAL, it could be added after the check
+        if (!is_added && errno != EINVAL && errno != EEXIST) {
+            make_errorf(error, "Cannot add the IIO sysfs trigger %u, error: %s", trigger->id, strerror(errno));
+            return false;
+        }
+    }
+    if (!is_added) {
+        make_errorf(error, "No free IIO sysfs trigger id in %u..%u", first_id, first_id + IIO_SYSFS_TRIGGER_PROBES - 1);
+        return false;
+    }
+    if (!iio_trigger_find_dir(name, dir_name, sizeof(dir_name))) {
+        make_errorf(error, "Cannot find the created trigger: %s", name);
+        iio_trigger_close(trigger);
+        return false;
+    }
+    snprintf(path, DEVICE_MAX_PATH, IIO_TRIGGER_NOW_PATH, G_root_path, dir_name);
+    trigger->fd_trigger_now = open(path, O_WRONLY);
+    if (trigger->fd_trigger_now < 0) {
+        make_errorf(error, "Cannot open %s, error: %s", path, strerror(errno));
+        iio_trigger_close(trigger);
+        return false;
+    }
+    debug("Created IIO trigger: %s (%s)\n", name, dir_name);
+    return true;
+}
+
+bool iio_trigger_fire(const iio_trigger_t *trigger, char **error) {
+    if (pwrite(trigger->fd_trigger_now, "1", 1, 0) != 1) {
+        make_errorf(error, "Cannot fire the IIO trigger: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void iio_trigger_close(iio_trigger_t *trigger) {
+    char path[DEVICE_MAX_PATH] = {0};
+    char value[16] = {0};
+    if (trigger->fd_trigger_now >= 0) {
+        close(trigger->fd_trigger_now);
+        trigger->fd_trigger_now = -1;
+    }
+    snprintf(path, DEVICE_MAX_PATH, IIO_SYSFS_TRIGGER_PATH, G_root_path, "remove_trigger");
+    snprintf(value, sizeof(value), "%u", trigger->id);
+    iio_write_string(path, value, NULL);
+}
+
+static const char * const G_accel_scan_channels[IIO_ACCEL_SCAN_MAX_CHANNELS] = {
+    "in_accel_x", "in_accel_y", "in_accel_z",
+    "in_anglvel_x", "in_anglvel_y", "in_anglvel_z",
+    "in_timestamp"
+};
+
+static inline bool accel_scan_channel_is_used(const accel_device_t *device, size_t channel) {
+    return channel < 3 || channel == 6 || device->has_anglvel;
+}
+
+// Computes the offsets of the enabled channels. Channels are ordered by index and naturally aligned
+static bool iio_device_accel_read_scan_layout(accel_device_t *device, char **error) {
+    int indexes[IIO_ACCEL_SCAN_MAX_CHANNELS];
+    for (size_t i = 0; i < IIO_ACCEL_SCAN_MAX_CHANNELS; i++) {
+        indexes[i] = -1;
+        if (!accel_scan_channel_is_used(device, i)) continue;
+        if (!iio_device_channel_read_scan_type(device->device_id, G_accel_scan_channels[i], &device->scan_channels[i].type, error)) {
+            return false;
+        }
+        if (!iio_device_channel_read_scan_index(device->device_id, G_accel_scan_channels[i], &indexes[i], error)) {
+            return false;
+        }
+    }
+    size_t offset = 0, max_size = 1;
+    for (size_t placed = 0; ; placed++) {
+        // Next channel with the smallest index
+        int next = -1;
+        for (size_t i = 0; i < IIO_ACCEL_SCAN_MAX_CHANNELS; i++) {
+            if (indexes[i] >= 0 && (next < 0 || indexes[i] < indexes[next])) next = (int)i;
+        }
+        if (next < 0) break;
+        size_t size = device->scan_channels[next].type.storage_bits / 8;
+        offset = (offset + size - 1) / size * size;
+        device->scan_channels[next].offset = offset;
+        offset += size;
+        if (size > max_size) max_size = size;
+        indexes[next] = -1;
+    }
+    device->scan_size = (offset + max_size - 1) / max_size * max_size;
+    return true;
+}
+
+static void iio_device_accel_set_scan_enabled(accel_device_t *device, bool enabled) {
+    for (size_t i = 0; i < IIO_ACCEL_SCAN_MAX_CHANNELS; i++) {
+        if (accel_scan_channel_is_used(device, i)) {
+            iio_device_channel_set_scan_enabled(device->device_id, G_accel_scan_channels[i], enabled, NULL);
+        }
+    }
+}
+
+bool iio_device_accel_attach_trigger(accel_device_t *device, const iio_trigger_t *trigger, char **error) {
+    char path[DEVICE_MAX_PATH] = {0};
+    char name[32] = {0};
+    device->samples_len = 0;
+    if (!iio_device_check_capture_free(device->device_id, error)) {
+        return false;
+    }
+    if (!iio_device_accel_read_scan_layout(device, error)) {
+        return false;
+    }
+    // Timestamps should use the same clock as the daemon. Old kernels don't have the attribute
+    // and use CLOCK_REALTIME, the timestamps are converted then
+    snprintf(path, DEVICE_MAX_PATH, IIO_TIMESTAMP_CLOCK_PATH, G_root_path, (unsigned int)device->device_id);
+    iio_read_string(path, device->timestamp_clock, sizeof(device->timestamp_clock));
+    device->is_realtime_timestamp = !iio_write_string(path, "monotonic\n", NULL);
+    if (device->is_realtime_timestamp) {
+        debug("Cannot set the monotonic timestamp clock for device %u: %s, converting from realtime\n",
+              (unsigned int)device->device_id, strerror(errno));
+        device->timestamp_clock[0] = '\0';
+    }
+    
+    snprintf(path, DEVICE_MAX_PATH, IIO_TRIGGER_PATH, G_root_path, (unsigned int)device->device_id);
+    snprintf(name, sizeof(name), IIO_SYSFS_TRIGGER_NAME, trigger->id);
+    if (!iio_write_string(path, name, error)) {
+        iio_device_accel_detach_trigger(device);
+        return false;
+    }
+    device->is_trigger_owned = true;
+    for (size_t i = 0; i < IIO_ACCEL_SCAN_MAX_CHANNELS; i++) {
+        if (!accel_scan_channel_is_used(device, i)) continue;
+        if (!iio_device_channel_set_scan_enabled(device->device_id, G_accel_scan_channels[i], true, error)) {
+            iio_device_accel_detach_trigger(device);
+            return false;
+        }
+    }
+    if (!iio_device_buffer_set_enabled(device->device_id, true, IIO_BUFFER_LENGTH, error)) {
+        iio_device_accel_detach_trigger(device);
+        return false;
+    }
+    if (!iio_device_buffer_open(device->device_id, &device->fd_buffer, error)) {
+        iio_device_accel_detach_trigger(device);
+        return false;
+    }
+    return true;
+}
+
+void iio_device_accel_detach_trigger(accel_device_t *device) {
+    char path[DEVICE_MAX_PATH] = {0};
+    if (device->fd_buffer >= 0) {
+        close(device->fd_buffer);
+        device->fd_buffer = -1;
+    }
+    if (device->is_trigger_owned) {
+        iio_device_buffer_set_enabled(device->device_id, false, 0, NULL);
+        iio_device_accel_set_scan_enabled(device, false);
+        snprintf(path, DEVICE_MAX_PATH, IIO_TRIGGER_PATH, G_root_path, (unsigned int)device->device_id);
+        iio_write_string(path, "\n", NULL);
+        device->is_trigger_owned = false;
+    }
+    if (device->timestamp_clock[0] != '\0') {
+        snprintf(path, DEVICE_MAX_PATH, IIO_TIMESTAMP_CLOCK_PATH, G_root_path, (unsigned int)device->device_id);
+        iio_write_string(path, device->timestamp_clock, NULL);
+        device->timestamp_clock[0] = '\0';
+    }
+}
+
+static inline double iio_scan_channel_value(const iio_scan_channel_t *channel, const uint8_t *scan) {
+    return (double)iio_scan_type_decode(&channel->type, scan + channel->offset);
+}
+
+static void iio_device_accel_decode_scan(const accel_device_t *device, const uint8_t *scan, accel_state_t *state) {
+    const iio_scan_channel_t *channels = device->scan_channels;
+    state->x = iio_scan_channel_value(&channels[0], scan);
+    state->y = iio_scan_channel_value(&channels[1], scan);
+    state->z = iio_scan_channel_value(&channels[2], scan);
+    accel_state_apply_scale(state, device->scale);
+    state->has_anglvel = device->has_anglvel;
+    state->xz_angle_delta = 0.0;
+    if (device->has_anglvel) {
+        state->anglvel.x = iio_scan_channel_value(&channels[3], scan);
+        state->anglvel.y = iio_scan_channel_value(&channels[4], scan);
+        state->anglvel.z = iio_scan_channel_value(&channels[5], scan);
+        anglvel_state_apply_scale(&state->anglvel, device->anglvel_scale);
+    }
+    state->timestamp = iio_scan_type_decode(&channels[6].type, scan + channels[6].offset);
+    if (device->is_realtime_timestamp) {
+        // Current offset, the realtime clock can be stepped
+        state->timestamp += monotonic_ns() - realtime_ns();
+    }
+}
+
+// Waits for the triggered scan and keeps the two most recent samples
+static bool iio_device_accel_read_buffer(accel_device_t *device, char **error) {
+    struct pollfd pfd = { .fd = device->fd_buffer, .events = POLLIN, .revents = 0 };
+    if (poll(&pfd, 1, IIO_TRIGGER_WAIT_MS) < 0) {
+        make_errorf(error, "Accel buffer poll error: %s", strerror(errno));
+        return false;
+    }
+    uint8_t scan[64];
+    bool has_sample = false;
+    for (;;) {
+        ssize_t len = read(device->fd_buffer, scan, device->scan_size);
+        if (len < 0) {
+            if (errno == EAGAIN) break;
+            make_errorf(error, "Cannot read the accel buffer: %s", strerror(errno));
+            return false;
+        }
+        if ((size_t)len < device->scan_size) break;
+        device->samples[0] = device->samples[1];
+        iio_device_accel_decode_scan(device, scan, &device->samples[1]);
+        if (device->samples_len < 2) device->samples_len++;
+        has_sample = true;
+    }
+    if (!has_sample) {
+        make_errorf(error, "No triggered sample from accel device: %u", (unsigned int)device->device_id);
+        return false;
+    }
     return true;
 }
 
+static inline void accel_state_interpolate(const accel_state_t *a, const accel_state_t *b, double k, accel_state_t *result) {
+    result->x = a->x + (b->x - a->x) * k;
+    result->y = a->y + (b->y - a->y) * k;
+    result->z = a->z + (b->z - a->z) * k;
+    result->has_anglvel = b->has_anglvel;
+    result->anglvel.x = a->anglvel.x + (b->anglvel.x - a->anglvel.x) * k;
+    result->anglvel.y = a->anglvel.y + (b->anglvel.y - a->anglvel.y) * k;
+    result->anglvel.z = a->anglvel.z + (b->anglvel.z - a->anglvel.z) * k;
+    result->xz_angle_delta = 0.0;
+}
+
+int64_t sensor_batch_get_skew(const sensor_batch_t *batch) {
+    int64_t min = INT64_MAX;
+    int64_t max = INT64_MIN;
+    for (size_t i = 0; i < batch->sensors_len; i++) {
+        if (!batch->is_present[i]) continue;
+        if (batch->timestamp[i] < min) min = batch->timestamp[i];
+        if (batch->timestamp[i] > max) max = batch->timestamp[i];
+    }
+    return max > min ? max - min : 0;
+}
+
+void anglvel_integrator_reset(anglvel_integrator_t *integrator) {
+    *integrator = (anglvel_integrator_t){0};
+}
+
+void anglvel_integrator_add(anglvel_integrator_t *integrator, const accel_state_t *state) {
+    double rate = accel_state_get_xz_angle_rate(state);
+    if (integrator->has_rate) {
+        double step = (double)(state->timestamp - integrator->timestamp) / 1000000000.0;
+        // Same buffered scan read again
+        if (step <= 0.0) {
+            return;
+        }
+        integrator->delta += 0.5 * (rate + integrator->rate) * step;
+        if (step > integrator->max_step) integrator->max_step = step;
+    }
+    integrator->has_rate = true;
+    integrator->rate = rate;
+    integrator->timestamp = state->timestamp;
+}
+
+void sensor_batch_integrate_anglvel(sensor_batch_t *batch, anglvel_integrator_t *integrators) {
+    accel_state_t state;
+    for (size_t i = 0; i < batch->sensors_len; i++) {
+        anglvel_integrator_t *integrator = &integrators[i];
+        batch->xz_angle_delta[i] = 0.0;
+        if (!batch->is_present[i] || !batch->has_anglvel[i]) {
+            anglvel_integrator_reset(integrator);
+            batch->has_anglvel[i] = false;
+            continue;
+        }
+        bool has_rate = integrator->has_rate;
+        sensor_batch_get_state(batch, i, &state);
+        anglvel_integrator_add(integrator, &state);
+        batch->xz_angle_delta[i] = integrator->delta;
+        batch->has_anglvel[i] = has_rate && integrator->max_step <= DEVICE_ANGLVEL_MAX_STEP;
+        integrator->delta = 0.0;
+        integrator->max_step = 0.0;
+    }
+}
+
+bool device_layout_add_hinge(device_layout_t *layout, uint8_t first, uint8_t second, uint16_t output) {
+    if (layout->hinges_len >= DEVICE_MAX_HINGES || first >= layout->sensors_len || second >= layout->sensors_len) {
+        return false;
+    }
+    size_t h = layout->hinges_len++;
+    layout->hinge_first[h] = first;
+    layout->hinge_second[h] = second;
+    layout->hinge_is_measured[h] = false;
+    layout->hinge_output[h] = output;
+    return true;
+}
+
+bool device_layout_add_measured_hinge(device_layout_t *layout, uint16_t output) {
+    if (layout->hinges_len >= DEVICE_MAX_HINGES) {
+        return false;
+    }
+    size_t h = layout->hinges_len++;
+    layout->hinge_first[h] = 0;
+    layout->hinge_second[h] = 0;
+    layout->hinge_is_measured[h] = true;
+    layout->hinge_output[h] = output;
+    return true;
+}
+
+void device_layout_get_hinge_angles(const device_layout_t *layout, const sensor_batch_t *batch,
+                                    const double *sensor_angles, double *angles, bool *is_present) {
+    double first[DEVICE_MAX_HINGES];
+    double second[DEVICE_MAX_HINGES];
+    // Gather the sensor angles, so the arithmetic below runs over plain arrays
+    for (size_t h = 0; h < layout->hinges_len; h++) {
+        first[h] = sensor_angles[layout->hinge_first[h]];
+        second[h] = sensor_angles[layout->hinge_second[h]];
+        is_present[h] = layout->hinge_is_measured[h] ||
+            (batch->is_present[layout->hinge_first[h]] && batch->is_present[layout->hinge_second[h]]);
+    }
+    for (size_t h = 0; h < layout->hinges_len; h++) {
+        double angle = second[h] - first[h];
+        // Folded past 180 degrees
+        angle += (angle < 0 && second[h] < 0 && first[h] > 0) ? 360.0 : 0.0;
+        angle = layout->hinge_is_measured[h] ? batch->hinge_angle[h] : angle;
+        angles[h] = is_present[h] ? angle : 0.0;
+    }
+}
+
+static void accel_group_detach_trigger(accel_group_t *group) {
+    for (size_t i = 0; i < group->len; i++) {
+        if (group->synchronized & (1u << i)) {
+            iio_device_accel_detach_trigger(&group->sensors[i]);
+        }
+    }
+    group->synchronized = 0;
+    iio_trigger_close(&group->trigger);
+}
+
+bool accel_group_open(const uint8_t *device_ids, size_t len, uint32_t detachable, accel_group_t *group, char **error) {
+    char *trigger_error = NULL;
+    if (len > DEVICE_MAX_SENSORS) {
+        make_errorf(error, "Too many accelerometers: %zu, max %d", len, DEVICE_MAX_SENSORS);
+        return false;
+    }
+    group->len = len;
+    group->detachable = detachable;
+    group->present = 0;
+    group->synchronized = 0;
+    size_t fixed_len = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t bit = 1u << i;
+        group->device_ids[i] = device_ids[i];
+        if (!iio_device_accel_open(device_ids[i], &group->sensors[i], (detachable & bit) ? NULL : error)) {
+            if (detachable & bit) {
+                debug("Accelerometer %u is detached\n", (unsigned int)device_ids[i]);
+                continue;
+            }
+            accel_group_close(group);
+            return false;
+        }
+        group->present |= bit;
+        if (!(detachable & bit)) fixed_len++;
+    }
+    // Shared trigger is optional. Without it the sensors are read one after another through sysfs
+    if (fixed_len < 2) {
+        return true;
+    }
+    if (!iio_trigger_open(&group->trigger, &trigger_error)) {
+        goto not_synchronized;
+    }
+    for (size_t i = 0; i < len; i++) {
+        uint32_t bit = 1u << i;
+        if (!(group->present & bit) || (detachable & bit)) continue;
+        if (!iio_device_accel_attach_trigger(&group->sensors[i], &group->trigger, &trigger_error)) {
+            accel_group_detach_trigger(group);
+            goto not_synchronized;
+        }
+        group->synchronized |= bit;
+    }
+    debug("Accelerometers use the shared trigger\n");
+    return true;
+not_synchronized:
+    debug("Accelerometers aren't synchronized: %s\n", trigger_error);
+    error_free(trigger_error);
+    return true;
+}
+
+// Detached sensors are reopened as soon as they are back. Returns false if the sensor is absent.
+static bool accel_group_read_detachable(accel_group_t *group, size_t i, accel_state_t *state) {
+    uint32_t bit = 1u << i;
+    accel_device_t *sensor = &group->sensors[i];
+    if (!(group->present & bit)) {
+        if (iio_device_is_available(group->device_ids[i]) && iio_device_accel_open(group->device_ids[i], sensor, NULL)) {
+            debug("Accelerometer %u is attached\n", (unsigned int)group->device_ids[i]);
+            group->present |= bit;
+        }
+        return false;
+    }
+    if (!iio_device_accel_read_state(sensor, state, NULL)) {
+        debug("Accelerometer %u is detached\n", (unsigned int)group->device_ids[i]);
+        iio_device_accel_close(sensor);
+        group->present &= ~bit;
+        return false;
+    }
+    return true;
+}
+
+bool accel_group_read(accel_group_t *group, sensor_batch_t *batch, char **error) {
+    accel_state_t state;
+    const accel_state_t *reference = NULL;
+    batch->sensors_len = group->len;
+    if (group->synchronized != 0 && !iio_trigger_fire(&group->trigger, error)) {
+        return false;
+    }
+    for (size_t i = 0; i < group->len; i++) {
+        uint32_t bit = 1u << i;
+        accel_device_t *sensor = &group->sensors[i];
+        batch->is_present[i] = true;
+        if (group->synchronized & bit) {
+            if (!iio_device_accel_read_buffer(sensor, error)) {
+                return false;
+            }
+            const accel_state_t *prev = &sensor->samples[0];
+            const accel_state_t *last = &sensor->samples[1];
+            // Bring the sample to the capture time of the first sensor if it is between two samples
+            if (reference == NULL) {
+                reference = last;
+                state = *last;
+            } else if (sensor->samples_len == 2 && prev->timestamp <= reference->timestamp && reference->timestamp < last->timestamp) {
+                double k = (double)(reference->timestamp - prev->timestamp) / (double)(last->timestamp - prev->timestamp);
+                accel_state_interpolate(prev, last, k, &state);
+                state.timestamp = reference->timestamp;
+            } else {
+                state = *last;
+            }
+        } else if (group->detachable & bit) {
+            if (!accel_group_read_detachable(group, i, &state)) {
+                batch->is_present[i] = false;
+                state = (accel_state_t){0};
+            }
+        } else if (!iio_device_accel_read_state(sensor, &state, error)) {
+            return false;
+        }
+        sensor_batch_set_state(batch, i, &state);
+    }
+    return true;
+}
+
+bool accel_group_read_anglvel(accel_group_t *group, sensor_batch_t *batch, char **error) {
+    accel_state_t state = {0};
+    batch->sensors_len = group->len;
+    // Buffered sensors return whole scans, the accel values are kept for the interpolation
+    if (group->synchronized != 0 && !iio_trigger_fire(&group->trigger, error)) {
+        return false;
+    }
+    for (size_t i = 0; i < group->len; i++) {
+        uint32_t bit = 1u << i;
+        accel_device_t *sensor = &group->sensors[i];
+        batch->is_present[i] = (group->present & bit) != 0;
+        batch->has_anglvel[i] = false;
+        if (!batch->is_present[i] || !sensor->has_anglvel) {
+            continue;
+        }
+        if (group->synchronized & bit) {
+            if (!iio_device_accel_read_buffer(sensor, error)) {
+                return false;
+            }
+            state = sensor->samples[1];
+        } else if (!iio_device_accel_read_anglvel(sensor, &state, (group->detachable & bit) ? NULL : error)) {
+            // Detachment is handled by the next accel_group_read
+            if (group->detachable & bit) continue;
+            return false;
+        }
+        sensor_batch_set_state(batch, i, &state);
+    }
+    return true;
+}
+
+bool accel_group_has_anglvel(const accel_group_t *group) {
+    for (size_t i = 0; i < group->len; i++) {
+        if ((group->present & (1u << i)) && group->sensors[i].has_anglvel) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void accel_group_close(accel_group_t *group) {
+    if (group->synchronized != 0) {
+        accel_group_detach_trigger(group);
+    }
+    for (size_t i = 0; i < group->len; i++) {
+        if (group->present & (1u << i)) {
+            iio_device_accel_close(&group->sensors[i]);
+        }
+    }
+    group->present = 0;
+}
+
+// Buffered mode is optional. Failures are logged and the sensor is read through sysfs.
+static bool iio_device_hinge_open_buffer(hinge_device_t *device) {
+    char *error = NULL;
+    if (!iio_device_check_capture_free(device->device_id, &error)) {
+        goto failed;
+    }
+    if (!iio_device_channel_read_scan_type(device->device_id, IIO_HINGE_CHANNEL, &device->scan_type, &error)) {
+        goto failed;
+    }
+    if (!iio_device_channel_set_scan_enabled(device->device_id, IIO_HINGE_CHANNEL, true, &error)) {
+        goto failed;
+    }
+    if (!iio_device_buffer_set_enabled(device->device_id, true, IIO_BUFFER_LENGTH, &error)) {
+        iio_device_channel_set_scan_enabled(device->device_id, IIO_HINGE_CHANNEL, false, NULL);
+        goto failed;
+    }
+    if (!iio_device_buffer_open(device->device_id, &device->fd_buffer, &error)) {
+        iio_device_buffer_set_enabled(device->device_id, false, 0, NULL);
+        iio_device_channel_set_scan_enabled(device->device_id, IIO_HINGE_CHANNEL, false, NULL);
+        goto failed;
+    }
+    debug("Hinge sensor %u is buffered\n", (unsigned int)device->device_id);
+    return true;
+failed:
+    debug("Hinge sensor %u isn't buffered: %s\n", (unsigned int)device->device_id, error);
+    error_free(error);
+    device->fd_buffer = -1;
+    return false;
+}
+
+void iio_device_hinge_set_scale(hinge_device_t *device, double scale, double offset) {
+    // (raw + offset) * scale is in radians
+    device->scale = scale * 180.0 / M_PI;
+    device->offset = offset;
+}
+
+double iio_device_hinge_get_angle(const hinge_device_t *device, double raw) {
+    return (raw + device->offset) * device->scale;
+}
+
+bool iio_device_hinge_is_available(uint8_t device_id) {
+    struct stat st;
+    char path[DEVICE_MAX_PATH] = {0};
+    snprintf(path, DEVICE_MAX_PATH, IIO_CHANNEL_PATH, G_root_path, (unsigned int)device_id, IIO_HINGE_CHANNEL, "raw");
+    return stat(path, &st) == 0;
+}
+
+bool iio_device_hinge_open(uint8_t device_id, hinge_device_t *device, char **error) {
+    char value_buffer[20] = {0};
+    double raw = 0.0;
+    double scale = 1.0;
+    double offset = 0.0;
+    device->device_id = device_id;
+    device->fd_buffer = -1;
+    if (!iio_device_read_scale(IIO_HINGE_OFFSET_PATH, device_id, &offset, NULL)) {
+        offset = 0.0;
+    }
+    if (iio_device_read_scale(IIO_HINGE_SCALE_PATH, device_id, &scale, NULL)) {
+        iio_device_hinge_set_scale(device, scale, offset);
+    } else {
+        // Without a scale the raw value is taken as degrees
+        device->scale = 1.0;
+        device->offset = offset;
+    }
+    char path[DEVICE_MAX_PATH] = {0};
+    snprintf(path, DEVICE_MAX_PATH, IIO_CHANNEL_PATH, G_root_path, (unsigned int)device_id, IIO_HINGE_CHANNEL, "raw");
+    device->fd_raw = open(path, O_RDONLY);
+    if (device->fd_raw < 0) {
+        make_errorf(error, "Cannot open the hinge angle: %s, error: %s", path, strerror(errno));
+        return false;
+    }
+    // The buffer is filled only on changes. Start from the current value
+    if (!iio_read_double_value(device->fd_raw, value_buffer, &raw)) {
+        close(device->fd_raw);
+        device->fd_raw = -1;
+        make_errorf(error, "Cannot read the hinge angle from: %s", path);
+        return false;
+    }
+    device->angle = iio_device_hinge_get_angle(device, raw);
+    iio_device_hinge_open_buffer(device);
+    return true;
+}
+
+bool iio_device_hinge_read_angle(hinge_device_t *device, double *angle, char **error) {
+    if (device->fd_buffer < 0) {
+        char value_buffer[20] = {0};
+        double raw = 0.0;
+        if (!iio_read_double_value(device->fd_raw, value_buffer, &raw)) {
+            make_error(error, "Cannot read the hinge angle");
+            return false;
+        }
+        device->angle = iio_device_hinge_get_angle(device, raw);
+        *angle = device->angle;
+        return true;
+    }
+    // Drain the buffer and keep the most recent sample
+    size_t sample_size = device->scan_type.storage_bits / 8;
+    uint8_t buffer[IIO_BUFFER_LENGTH * 8];
+    for (;;) {
+        ssize_t len = read(device->fd_buffer, buffer, sample_size * IIO_BUFFER_LENGTH);
+        if (len < 0) {
+            if (errno == EAGAIN) break;
+            make_errorf(error, "Cannot read the hinge buffer: %s", strerror(errno));
+            return false;
+        }
+        if ((size_t)len < sample_size) break;
+        const uint8_t *last = buffer + ((size_t)len / sample_size - 1) * sample_size;
+        device->angle = iio_device_hinge_get_angle(device, (double)iio_scan_type_decode(&device->scan_type, last));
+        if ((size_t)len < sample_size * IIO_BUFFER_LENGTH) break;
+    }
+    *angle = device->angle;
+    return true;
+}
+
+void iio_device_hinge_close(hinge_device_t *device) {
+    if (device->fd_buffer >= 0) {
+        close(device->fd_buffer);
+        iio_device_buffer_set_enabled(device->device_id, false, 0, NULL);
+        iio_device_channel_set_scan_enabled(device->device_id, IIO_HINGE_CHANNEL, false, NULL);
+        device->fd_buffer = -1;
+    }
+    if (device->fd_raw >= 0) {
+        close(device->fd_raw);
+        device->fd_raw = -1;
+    }
+}
+
 bool laptop_device_get_model(char **model, char **error) {
-    int fd = open("/sys/devices/virtual/dmi/id/product_name", O_RDONLY);
+    char path[DEVICE_MAX_PATH] = {0};
+    snprintf(path, DEVICE_MAX_PATH, DMI_PRODUCT_NAME_PATH, G_root_path);
+    int fd = open(path, O_RDONLY);
     if (fd <= 0) {
         make_errorf(error, "Can't open DMI device: %s", strerror(errno));
         return false;
@@ -1,29 +1,183 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
 
+// Default minimal gravity projection on X or Z axis (m/s^2) for the XZ angle to be meaningful
+#define ACCEL_XZ_GRAVITY_THRESHOLD 3.0
+
+// Sensor group limits. Masks of the sensors are stored in uint32_t
+#define DEVICE_MAX_SENSORS 8
+#define DEVICE_MAX_HINGES 8
+
+// Gyroscope readings between the samples are taken at this interval (seconds)
+#define DEVICE_ANGLVEL_PERIOD 0.02
+// Longest interval between two gyroscope readings for the integrated angle to be used (seconds)
+#define DEVICE_ANGLVEL_MAX_STEP 0.05
+
+struct anglvel_state_s {
+    double x;
+    double y;
+    double z;
+};
+
+typedef struct anglvel_state_s anglvel_state_t;
+
 struct accel_state_s {
     double x;
     double y;
     double z;
+    // Angular velocity in rad/s. Valid only if has_anglvel is true.
+    bool has_anglvel;
+    anglvel_state_t anglvel;
+    // XZ angle change in degrees integrated from the gyroscope since the previous sample,
+    // see anglvel_integrator_t. Valid only if has_anglvel is true.
+    double xz_angle_delta;
+    // Capture time in nanoseconds, CLOCK_MONOTONIC
+    int64_t timestamp;
 };
 
 typedef struct accel_state_s accel_state_t;
 
+struct iio_scan_type_s {
+    bool is_signed;
+    bool is_big_endian;
+    uint8_t bits;
+    uint8_t storage_bits;
+    uint8_t shift;
+};
+
+typedef struct iio_scan_type_s iio_scan_type_t;
+
+// Accel x, y, z, anglvel x, y, z and timestamp
+#define IIO_ACCEL_SCAN_MAX_CHANNELS 7
+
+struct iio_scan_channel_s {
+    iio_scan_type_t type;
+    size_t offset;
+};
+
+typedef struct iio_scan_channel_s iio_scan_channel_t;
+
 struct accel_device_s {
+    uint8_t device_id;
     int fd_x;
     int fd_y;
     int fd_z;
     double scale;
+    // Optional gyroscope channels of the same IIO device
+    bool has_anglvel;
+    int fd_anglvel_x;
+    int fd_anglvel_y;
+    int fd_anglvel_z;
+    double anglvel_scale;
+    // Buffered capture through a trigger. fd_buffer is -1 if values are read through sysfs
+    int fd_buffer;
+    size_t scan_size;
+    // The scan timestamps are on CLOCK_REALTIME, current_timestamp_clock can't be set
+    bool is_realtime_timestamp;
+    // Capture state changed by the daemon, only that is restored on detach. The previous
+    // current_timestamp_clock is empty if it wasn't changed
+    bool is_trigger_owned;
+    char timestamp_clock[16];
+    iio_scan_channel_t scan_channels[IIO_ACCEL_SCAN_MAX_CHANNELS];
+    // Two most recent buffered samples, for the interpolation
+    size_t samples_len;
+    accel_state_t samples[2];
 };
 
 typedef struct accel_device_s accel_device_t;
 
+// IIO sysfs trigger shared by several devices, so they sample at the same instant
+struct iio_trigger_s {
+    unsigned int id;
+    int fd_trigger_now;
+};
+
+typedef struct iio_trigger_s iio_trigger_t;
+
+// Accelerometers sampled together. Detachable sensors (keyboard of a detachable) can disappear
+// and come back at runtime, they are read through sysfs.
+struct accel_group_s {
+    size_t len;
+    uint8_t device_ids[DEVICE_MAX_SENSORS];
+    accel_device_t sensors[DEVICE_MAX_SENSORS];
+    uint32_t detachable;    // mask of the detachable sensors
+    uint32_t present;       // mask of the opened sensors
+    uint32_t synchronized;  // mask of the sensors attached to the trigger
+    iio_trigger_t trigger;
+};
+
+typedef struct accel_group_s accel_group_t;
+
+// Readings of all sensors in one tick. Struct of arrays, so the per-sensor passes vectorize
+struct sensor_batch_s {
+    size_t sensors_len;
+    double x[DEVICE_MAX_SENSORS];
+    double y[DEVICE_MAX_SENSORS];
+    double z[DEVICE_MAX_SENSORS];
+    double anglvel_x[DEVICE_MAX_SENSORS];
+    double anglvel_y[DEVICE_MAX_SENSORS];
+    double anglvel_z[DEVICE_MAX_SENSORS];
+    double xz_angle_delta[DEVICE_MAX_SENSORS];
+    int64_t timestamp[DEVICE_MAX_SENSORS];
+    bool has_anglvel[DEVICE_MAX_SENSORS];
+    bool is_present[DEVICE_MAX_SENSORS];
+    // Angles of the measured hinges in degrees, see device_layout_t
+    double hinge_angle[DEVICE_MAX_HINGES];
+};
+
+typedef struct sensor_batch_s sensor_batch_t;
+
+// Integrates the XZ angle rate of one sensor over the gyroscope readings between two samples
+struct anglvel_integrator_s {
+    bool has_rate;
+    double rate;        // deg/s, the last reading
+    int64_t timestamp;  // of the last reading
+    double delta;       // degrees since the last sample
+    double max_step;    // longest interval between two readings since the last sample in seconds
+};
+
+typedef struct anglvel_integrator_s anglvel_integrator_t;
+
+// Sensors of the device and the hinges between them. Hinge h is the angle from sensor
+// hinge_first[h] (screen) to hinge_second[h] (base), or the value of a hinge angle sensor
+// if hinge_is_measured[h] is set. Each hinge drives the EV_SW switch hinge_output[h],
+// several hinges can drive the same switch.
+struct device_layout_s {
+    size_t sensors_len;
+    size_t hinges_len;
+    uint8_t hinge_first[DEVICE_MAX_HINGES];
+    uint8_t hinge_second[DEVICE_MAX_HINGES];
+    bool hinge_is_measured[DEVICE_MAX_HINGES];
+    uint16_t hinge_output[DEVICE_MAX_HINGES];
+};
+
+typedef struct device_layout_s device_layout_t;
+
+// Hinge angle sensor (HID sensor hub "hinge" device)
+struct hinge_device_s {
+    uint8_t device_id;
+    int fd_raw;
+    int fd_buffer; // -1 if buffer can't be used
+    iio_scan_type_t scan_type;
+    double scale;  // degrees per raw unit
+    double offset;
+    double angle;  // last known angle in degrees
+};
+
+typedef struct hinge_device_s hinge_device_t;
+
 struct laptop_device_s {
-    bool (*read_screen_accel)(const struct laptop_device_s *self, accel_state_t *state, char **error);
-    bool (*read_base_accel)(const struct laptop_device_s *self, accel_state_t *state, char **error);
+    device_layout_t layout;
+    // Reads all sensors of the layout in one batch
+    bool (*read_sensors)(struct laptop_device_s *self, sensor_batch_t *batch, char **error);
+    // Reads only the gyroscopes, between the samples. NULL if the device has no gyroscope
+    bool (*read_anglvel)(struct laptop_device_s *self, sensor_batch_t *batch, char **error);
+    // Reopens the sensors in place after a read failure
+    bool (*recover)(struct laptop_device_s *self, char **error);
     void (*destroy)(struct laptop_device_s *self);
 };
 
@@ -42,17 +196,116 @@ static inline void accel_state_apply_scale(accel_state_t *state, double scale) {
     state->z *= scale;
 }
 
+static inline void anglvel_state_apply_scale(anglvel_state_t *state, double scale) {
+    state->x *= scale;
+    state->y *= scale;
+    state->z *= scale;
+}
+
 static inline double accel_state_get_xz_angle(const accel_state_t *state) {
     return -atan2(state->x, state->z) * 180.0 / M_PI;
 }
 
+// Rate of change of the XZ angle in degrees per second.
+// Rotation around the Y axis turns gravity the other way, so the sign matches accel_state_get_xz_angle.
+static inline double accel_state_get_xz_angle_rate(const accel_state_t *state) {
+    return state->anglvel.y * 180.0 / M_PI;
+}
+
+static inline bool accel_state_has_xz_gravity(const accel_state_t *state, double threshold) {
+    return fabs(state->x) > threshold || fabs(state->z) > threshold;
+}
+
+static inline double accel_state_get_magnitude(const accel_state_t *state) {
+    return sqrt(state->x * state->x + state->y * state->y + state->z * state->z);
+}
+
+static inline void sensor_batch_get_state(const sensor_batch_t *batch, size_t i, accel_state_t *state) {
+    state->x = batch->x[i];
+    state->y = batch->y[i];
+    state->z = batch->z[i];
+    state->has_anglvel = batch->has_anglvel[i];
+    state->anglvel.x = batch->anglvel_x[i];
+    state->anglvel.y = batch->anglvel_y[i];
+    state->anglvel.z = batch->anglvel_z[i];
+    state->xz_angle_delta = batch->xz_angle_delta[i];
+    state->timestamp = batch->timestamp[i];
+}
+
+static inline void sensor_batch_set_state(sensor_batch_t *batch, size_t i, const accel_state_t *state) {
+    batch->x[i] = state->x;
+    batch->y[i] = state->y;
+    batch->z[i] = state->z;
+    batch->has_anglvel[i] = state->has_anglvel;
+    batch->anglvel_x[i] = state->anglvel.x;
+    batch->anglvel_y[i] = state->anglvel.y;
+    batch->anglvel_z[i] = state->anglvel.z;
+    batch->xz_angle_delta[i] = state->xz_angle_delta;
+    batch->timestamp[i] = state->timestamp;
+}
+
+// Capture time difference between the earliest and the latest present sensor in nanoseconds
+int64_t sensor_batch_get_skew(const sensor_batch_t *batch);
+
+void anglvel_integrator_reset(anglvel_integrator_t *integrator);
+// Adds a gyroscope reading, the rate is trapezoid integrated from the previous one
+void anglvel_integrator_add(anglvel_integrator_t *integrator, const accel_state_t *state);
+// Adds the readings of the sample and moves the integrated changes to xz_angle_delta. has_anglvel
+// is cleared if there were no readings before or they were too far apart
+void sensor_batch_integrate_anglvel(sensor_batch_t *batch, anglvel_integrator_t *integrators);
+
+// Returns false if the layout is full
+bool device_layout_add_hinge(device_layout_t *layout, uint8_t first, uint8_t second, uint16_t output);
+bool device_layout_add_measured_hinge(device_layout_t *layout, uint16_t output);
+// Computes all hinge angles from the per-sensor XZ angles in degrees. is_present[h] is false
+// if a sensor of the hinge is detached, its angle is 0 then.
+void device_layout_get_hinge_angles(const device_layout_t *layout, const sensor_batch_t *batch,
+                                    const double *sensor_angles, double *angles, bool *is_present);
+
+void device_set_root_path(const char *path);
+const char *device_get_root_path(void);
+
 bool laptop_device_get_model(char **model, char **error);
 
 bool iio_device_is_available(uint8_t device_id);
 bool iio_device_get_i2c_port(uint8_t device_id, uint8_t *port, char **error);
 bool iio_device_accel_read_scale(uint8_t device_id, double *scale, char **error);
+bool iio_device_anglvel_read_scale(uint8_t device_id, double *scale, char **error);
 
 bool iio_device_accel_open(uint8_t device_id, accel_device_t *device, char** error);
 bool iio_device_accel_read_state(const accel_device_t *device, accel_state_t *state, char **error);
+bool iio_device_accel_read_anglvel(const accel_device_t *device, accel_state_t *state, char **error);
 void iio_device_accel_close(accel_device_t *device);
 
+bool iio_device_find_by_name(const char *name, uint8_t *device_id);
+bool iio_device_channel_read_scan_type(uint8_t device_id, const char *channel, iio_scan_type_t *type, char **error);
+bool iio_device_channel_set_scan_enabled(uint8_t device_id, const char *channel, bool enabled, char **error);
+bool iio_device_buffer_set_enabled(uint8_t device_id, bool enabled, unsigned int length, char **error);
+bool iio_device_buffer_open(uint8_t device_id, int *fd, char **error);
+int64_t iio_scan_type_decode(const iio_scan_type_t *type, const uint8_t *data);
+
+bool iio_trigger_open(iio_trigger_t *trigger, char **error);
+bool iio_trigger_fire(const iio_trigger_t *trigger, char **error);
+void iio_trigger_close(iio_trigger_t *trigger);
+
+bool iio_device_accel_attach_trigger(accel_device_t *device, const iio_trigger_t *trigger, char **error);
+void iio_device_accel_detach_trigger(accel_device_t *device);
+
+// detachable is the mask of the sensors which may be absent
+bool accel_group_open(const uint8_t *device_ids, size_t len, uint32_t detachable, accel_group_t *group, char **error);
+bool accel_group_read(accel_group_t *group, sensor_batch_t *batch, char **error);
+// Reads the gyroscopes of the present sensors, has_anglvel is false for the rest
+bool accel_group_read_anglvel(accel_group_t *group, sensor_batch_t *batch, char **error);
+bool accel_group_has_anglvel(const accel_group_t *group);
+void accel_group_close(accel_group_t *group);
+
+// Takes in_angl_scale and in_angl_offset, the scaled value is in radians
+void iio_device_hinge_set_scale(hinge_device_t *device, double scale, double offset);
+// Angle in degrees of a raw in_angl value
+double iio_device_hinge_get_angle(const hinge_device_t *device, double raw);
+// The device has the hinge angle channel
+bool iio_device_hinge_is_available(uint8_t device_id);
+bool iio_device_hinge_open(uint8_t device_id, hinge_device_t *device, char **error);
+bool iio_device_hinge_read_angle(hinge_device_t *device, double *angle, char **error);
+void iio_device_hinge_close(hinge_device_t *device);
+
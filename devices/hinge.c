@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <linux/input.h>
+
+#include "hinge.h"
+#include "../debug.h"
+
+#define HINGE_IIO_DEVICE_NAME "hinge"
+
+// Any laptop which exposes the hinge angle directly (HID sensor hub hinge).
+// Checked before the model specific devices, so they are used only if the sensor is absent.
+typedef struct hinge_laptop_s {
+    laptop_device_t device;
+    hinge_device_t hinge;
+} hinge_laptop_t;
+
+__attribute__((noinline))
+static bool read_sensors(laptop_device_t *self, sensor_batch_t *batch, char **error) {
+    batch->sensors_len = 0;
+    return iio_device_hinge_read_angle(&((hinge_laptop_t*)self)->hinge, &batch->hinge_angle[0], error);
+}
+
+__attribute__((noinline))
+static void destroy(struct laptop_device_s *self) {
+    iio_device_hinge_close(&((hinge_laptop_t*)self)->hinge);
+    free((hinge_laptop_t*)self);
+}
+
+__attribute__((noinline))
+static bool recover(laptop_device_t *self, char **error) {
+    hinge_laptop_t *hdevice = (hinge_laptop_t*)self;
+    uint8_t device_id = 0;
+    debug("Recovering the hinge sensor\n");
+    iio_device_hinge_close(&hdevice->hinge);
+    // Device id can change if the sensor hub was re-enumerated
+    if (!iio_device_find_by_name(HINGE_IIO_DEVICE_NAME, &device_id)) {
+        make_error(error, "Cannot find the hinge angle sensor");
+        return false;
+    }
+    return iio_device_hinge_open(device_id, &hdevice->hinge, error);
+}
+
+__attribute__((noinline))
+static bool is_current_device(const char* model, size_t model_len) {
+    (void)(model);
+    (void)(model_len);
+    uint8_t device_id = 0;
+    debug("Checking if the device has a hinge angle sensor\n");
+    // Without the angle channel the accelerometers are used
+    return iio_device_find_by_name(HINGE_IIO_DEVICE_NAME, &device_id) && iio_device_hinge_is_available(device_id);
+}
+
+__attribute__((noinline))
+static bool create(laptop_device_t **device, char **error) {
+    uint8_t device_id = 0;
+    debug("Creating the hinge sensor device\n");
+    if (!iio_device_find_by_name(HINGE_IIO_DEVICE_NAME, &device_id)) {
+        make_error(error, "Cannot find the hinge angle sensor");
+        return false;
+    }
+    hinge_laptop_t *hdevice = (hinge_laptop_t*)malloc(sizeof(hinge_laptop_t));
+    if (!iio_device_hinge_open(device_id, &hdevice->hinge, error)) {
+        free(hdevice);
+        return false;
+    }
+    debug("Hinge angle sensor: id = %u\n", (unsigned int)device_id);
+    // The angle is used directly, no accelerometers are read
+    hdevice->device.layout = (device_layout_t){ .sensors_len = 0 };
+    device_layout_add_measured_hinge(&hdevice->device.layout, SW_TABLET_MODE);
+    hdevice->device.read_sensors = &read_sensors;
+    hdevice->device.read_anglvel = NULL;
+    hdevice->device.recover = &recover;
+    hdevice->device.destroy = &destroy;
+    *device = (laptop_device_t *)hdevice;
+    return true;
+}
+
+const laptop_device_factory_t device_hinge = {
+    .is_current_device = &is_current_device,
+    .create = &create
+};
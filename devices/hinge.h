@@ -0,0 +1,5 @@
+#pragma once
+
+#include "../device.h"
+
+extern const laptop_device_factory_t device_hinge;
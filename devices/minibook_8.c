@@ -3,30 +3,32 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <linux/input.h>
 
 #include "minibook_8.h"
 #include "../debug.h"
 
 typedef struct minibook8_s {
     laptop_device_t device;
-    accel_device_t screen;
-    accel_device_t base;
+    accel_group_t accels;
 } minibook8_t;
 
+// Screen and base
+static const uint8_t G_accel_ids[] = { 0, 1 };
+
 __attribute__((noinline))
-static bool read_screen_accel(const laptop_device_t *self, accel_state_t *state, char **error) {
-    return iio_device_accel_read_state(&((minibook8_t*)self)->screen, state, error);
+static bool read_sensors(laptop_device_t *self, sensor_batch_t *batch, char **error) {
+    return accel_group_read(&((minibook8_t*)self)->accels, batch, error);
 }
 
 __attribute__((noinline))
-static bool read_base_accel(const laptop_device_t *self, accel_state_t *state, char **error) {
-    return iio_device_accel_read_state(&((minibook8_t*)self)->base, state, error);
+static bool read_anglvel(laptop_device_t *self, sensor_batch_t *batch, char **error) {
+    return accel_group_read_anglvel(&((minibook8_t*)self)->accels, batch, error);
 }
 
 __attribute__((noinline))
 static void destroy(struct laptop_device_s *self) {
-    iio_device_accel_close(&((minibook8_t*)self)->screen);
-    iio_device_accel_close(&((minibook8_t*)self)->base);
+    accel_group_close(&((minibook8_t*)self)->accels);
     free((minibook8_t*)self);
 }
 
@@ -36,9 +38,8 @@ static bool is_current_device(const char* model, size_t model_len) {
     return model_len >= 9 && strncmp(model, "MiniBook\n", 9) == 0;
 }
 
-__attribute__((noinline))
-static bool create(laptop_device_t **device, char **error) {
-    debug("Creating the MiniBook 8 device\n");
+// Makes both accelerometers available. Base accelerometer isn't enabled by the firmware
+static bool enable_accels(char **error) {
     // Check that we have screen accelerometeer
     if (!iio_device_is_available(0)) {
       make_error(error, "Cannot find the screen accelerometer: id = 0");
@@ -69,13 +70,38 @@ static bool create(laptop_device_t **device, char **error) {
         }
     }
     debug("Base accelerometer is enabled\n");
+    return true;
+}
+
+__attribute__((noinline))
+static bool recover(laptop_device_t *self, char **error) {
+    minibook8_t *mdevice = (minibook8_t*)self;
+    debug("Recovering the MiniBook 8 accelerometers\n");
+    accel_group_close(&mdevice->accels);
+    if (!enable_accels(error)) {
+        return false;
+    }
+    return accel_group_open(G_accel_ids, 2, 0, &mdevice->accels, error);
+}
+
+__attribute__((noinline))
+static bool create(laptop_device_t **device, char **error) {
+    debug("Creating the MiniBook 8 device\n");
+    if (!enable_accels(error)) {
+        return false;
+    }
     // Accelerometers enabled
     minibook8_t *mdevice = (minibook8_t*)malloc(sizeof(minibook8_t));
-    if (!(iio_device_accel_open(0, &mdevice->screen, error) && iio_device_accel_open(1, &mdevice->base, error))) {
+    if (!accel_group_open(G_accel_ids, 2, 0, &mdevice->accels, error)) {
+        free(mdevice);
         return false;
     }
-    mdevice->device.read_screen_accel = &read_screen_accel;
-    mdevice->device.read_base_accel = &read_base_accel;
+    // Screen and base accelerometers with the hinge between them
+    mdevice->device.layout = (device_layout_t){ .sensors_len = 2 };
+    device_layout_add_hinge(&mdevice->device.layout, 0, 1, SW_TABLET_MODE);
+    mdevice->device.read_sensors = &read_sensors;
+    mdevice->device.read_anglvel = accel_group_has_anglvel(&mdevice->accels) ? &read_anglvel : NULL;
+    mdevice->device.recover = &recover;
     mdevice->device.destroy = &destroy;
     *device = (laptop_device_t *)mdevice;
     return true;
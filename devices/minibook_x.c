@@ -3,30 +3,32 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <linux/input.h>
 
 #include "minibook_x.h"
 #include "../debug.h"
 
 typedef struct minibookx_s {
     laptop_device_t device;
-    accel_device_t screen;
-    accel_device_t base;
+    accel_group_t accels;
 } minibookx_t;
 
+// Screen and base
+static const uint8_t G_accel_ids[] = { 0, 1 };
+
 __attribute__((noinline))
-static bool read_screen_accel(const laptop_device_t *self, accel_state_t *state, char **error) {
-    return iio_device_accel_read_state(&((minibookx_t*)self)->screen, state, error);
+static bool read_sensors(laptop_device_t *self, sensor_batch_t *batch, char **error) {
+    return accel_group_read(&((minibookx_t*)self)->accels, batch, error);
 }
 
 __attribute__((noinline))
-static bool read_base_accel(const laptop_device_t *self, accel_state_t *state, char **error) {
-    return iio_device_accel_read_state(&((minibookx_t*)self)->base, state, error);
+static bool read_anglvel(laptop_device_t *self, sensor_batch_t *batch, char **error) {
+    return accel_group_read_anglvel(&((minibookx_t*)self)->accels, batch, error);
 }
 
 __attribute__((noinline))
 static void destroy(struct laptop_device_s *self) {
-    iio_device_accel_close(&((minibookx_t*)self)->screen);
-    iio_device_accel_close(&((minibookx_t*)self)->base);
+    accel_group_close(&((minibookx_t*)self)->accels);
     free((minibookx_t*)self);
 }
 
@@ -36,9 +38,8 @@ static bool is_current_device(const char* model, size_t model_len) {
     return model_len >= 10 && strncmp(model, "MiniBook X", 10) == 0;
 }
 
-__attribute__((noinline))
-static bool create(laptop_device_t **device, char **error) {
-    debug("Creating the Minibook X device\n");
+// Makes both accelerometers available. Base accelerometer isn't enabled by the firmware
+static bool enable_accels(char **error) {
     // Check that we have screen accelerometeer
     if (!iio_device_is_available(0)) {
       make_error(error, "Cannot find the screen accelerometer: id = 0");
@@ -59,7 +60,7 @@ static bool create(laptop_device_t **device, char **error) {
         // Enable the accelerometer
         // echo mxc4005 0x15 > /sys/bus/i2c/devices/i2c-0/new_device
         debug("Enabling the base accelerometer\n");
-        sprintf(buffer, "/sys/bus/i2c/devices/i2c-%d/new_device", (int)i2c);
+        snprintf(buffer, sizeof(buffer), "%s/sys/bus/i2c/devices/i2c-%d/new_device", device_get_root_path(), (int)i2c);
         int fd = open(buffer, O_WRONLY);
         debug("Opening the i2c new device interface\n");
         if (fd <= 0) {
@@ -69,6 +70,7 @@ static bool create(laptop_device_t **device, char **error) {
         debug("Writing 'mxc4005 0x15' to the i2c new device interface\n");
         if (write(fd, "mxc4005 0x15\n", 13) != 13) {
             make_errorf(error, "Cannot write 'mxc4005 0x15' to the %s", buffer);
+            close(fd);
             return false;
         }
         close(fd);
@@ -81,13 +83,38 @@ static bool create(laptop_device_t **device, char **error) {
         }
     }
     debug("Base accelerometer is enabled\n");
+    return true;
+}
+
+__attribute__((noinline))
+static bool recover(laptop_device_t *self, char **error) {
+    minibookx_t *mdevice = (minibookx_t*)self;
+    debug("Recovering the Minibook X accelerometers\n");
+    accel_group_close(&mdevice->accels);
+    if (!enable_accels(error)) {
+        return false;
+    }
+    return accel_group_open(G_accel_ids, 2, 0, &mdevice->accels, error);
+}
+
+__attribute__((noinline))
+static bool create(laptop_device_t **device, char **error) {
+    debug("Creating the Minibook X device\n");
+    if (!enable_accels(error)) {
+        return false;
+    }
     // Accelerometers enabled
     minibookx_t *mdevice = (minibookx_t*)malloc(sizeof(minibookx_t));
-    if (!(iio_device_accel_open(0, &mdevice->screen, error) && iio_device_accel_open(1, &mdevice->base, error))) {
+    if (!accel_group_open(G_accel_ids, 2, 0, &mdevice->accels, error)) {
+        free(mdevice);
         return false;
     }
-    mdevice->device.read_screen_accel = &read_screen_accel;
-    mdevice->device.read_base_accel = &read_base_accel;
+    // Screen and base accelerometers with the hinge between them
+    mdevice->device.layout = (device_layout_t){ .sensors_len = 2 };
+    device_layout_add_hinge(&mdevice->device.layout, 0, 1, SW_TABLET_MODE);
+    mdevice->device.read_sensors = &read_sensors;
+    mdevice->device.read_anglvel = accel_group_has_anglvel(&mdevice->accels) ? &read_anglvel : NULL;
+    mdevice->device.recover = &recover;
     mdevice->device.destroy = &destroy;
     *device = (laptop_device_t *)mdevice;
     return true;
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <linux/input.h>
+
+#include "simulated.h"
+#include "../debug.h"
+
+// in_angl_scale of the HID sensor hub hinge: one degree per raw unit, in radians
+#define SIMULATED_HINGE_SCALE 0.017453293
+
+static simulation_t *G_simulation = NULL;
+
+typedef struct simulated_laptop_s {
+    laptop_device_t device;
+    simulation_t *simulation;
+    // Converts the raw values of the simulated hinge sensor like a real one
+    hinge_device_t hinge;
+    // Step whose fault was injected, and the recovery attempts failed for it
+    const simulation_step_t *faulty_step;
+    size_t failed_recoveries;
+} simulated_laptop_t;
+
+void device_simulated_set_simulation(simulation_t *simulation) {
+    G_simulation = simulation;
+}
+
+__attribute__((noinline))
+static void read_batch(laptop_device_t *self, sensor_batch_t *batch) {
+    simulation_t *simulation = ((simulated_laptop_t*)self)->simulation;
+    uint32_t absent = simulation_is_detached(simulation) ? simulation->scenario->detachable : 0;
+    accel_state_t state;
+    batch->sensors_len = self->layout.sensors_len;
+    for (size_t i = 0; i < batch->sensors_len; i++) {
+        batch->is_present[i] = (absent & (1u << i)) == 0;
+        if (!batch->is_present[i]) {
+            continue;
+        }
+        simulation_read_accel(simulation, i, &state);
+        sensor_batch_set_state(batch, i, &state);
+    }
+    if (self->layout.hinge_is_measured[0]) {
+        hinge_device_t *hinge = &((simulated_laptop_t*)self)->hinge;
+        double radians = simulation_read_hinge_angle(simulation) * M_PI / 180.0;
+        batch->hinge_angle[0] = iio_device_hinge_get_angle(hinge, round(radians / SIMULATED_HINGE_SCALE));
+    }
+}
+
+__attribute__((noinline))
+static bool read_sensors(laptop_device_t *self, sensor_batch_t *batch, char **error) {
+    simulated_laptop_t *sdevice = (simulated_laptop_t*)self;
+    const simulation_step_t *step = simulation_get_step(sdevice->simulation);
+    if (step->is_faulty && sdevice->faulty_step != step) {
+        sdevice->faulty_step = step;
+        sdevice->failed_recoveries = 0;
+        make_errorf(error, "Simulated sensor failure at %.3lf s", sdevice->simulation->time);
+        return false;
+    }
+    read_batch(self, batch);
+    return true;
+}
+
+__attribute__((noinline))
+static bool read_anglvel(laptop_device_t *self, sensor_batch_t *batch, char **error) {
+    (void)(error);
+    // Accel values come along, like in a buffered scan. Faults are injected in the ticks only
+    read_batch(self, batch);
+    return true;
+}
+
+__attribute__((noinline))
+static bool recover(laptop_device_t *self, char **error) {
+    simulated_laptop_t *sdevice = (simulated_laptop_t*)self;
+    if (sdevice->faulty_step != NULL && sdevice->failed_recoveries < sdevice->faulty_step->failed_recoveries) {
+        sdevice->failed_recoveries++;
+        make_error(error, "Simulated recovery failure");
+        return false;
+    }
+    return true;
+}
+
+__attribute__((noinline))
+static void destroy(struct laptop_device_s *self) {
+    free((simulated_laptop_t*)self);
+}
+
+__attribute__((noinline))
+static bool is_current_device(const char* model, size_t model_len) {
+    (void)(model);
+    (void)(model_len);
+    return G_simulation != NULL;
+}
+
+__attribute__((noinline))
+static bool create(laptop_device_t **device, char **error) {
+    if (G_simulation == NULL) {
+        make_error(error, "No simulation is selected");
+        return false;
+    }
+    debug("Creating the simulated device: %s\n", G_simulation->scenario->name);
+    simulated_laptop_t *sdevice = (simulated_laptop_t*)malloc(sizeof(simulated_laptop_t));
+    sdevice->simulation = G_simulation;
+    sdevice->faulty_step = NULL;
+    sdevice->failed_recoveries = 0;
+    if (G_simulation->scenario->has_hinge_sensor) {
+        iio_device_hinge_set_scale(&sdevice->hinge, SIMULATED_HINGE_SCALE, 0.0);
+        sdevice->device.layout = (device_layout_t){ .sensors_len = 0 };
+        device_layout_add_measured_hinge(&sdevice->device.layout, SW_TABLET_MODE);
+    } else {
+        // Screen and base accelerometers with the hinge between them, or a row of panels
+        // whose hinges share the switch
+        size_t panels = G_simulation->scenario->panels != 0 ? G_simulation->scenario->panels : 2;
+        sdevice->device.layout = (device_layout_t){ .sensors_len = panels };
+        for (size_t i = 0; i + 1 < panels; i++) {
+            device_layout_add_hinge(&sdevice->device.layout, i, i + 1, SW_TABLET_MODE);
+        }
+    }
+    sdevice->device.read_sensors = &read_sensors;
+    sdevice->device.read_anglvel = G_simulation->scenario->has_anglvel ? &read_anglvel : NULL;
+    sdevice->device.recover = &recover;
+    sdevice->device.destroy = &destroy;
+    *device = (laptop_device_t *)sdevice;
+    return true;
+}
+
+const laptop_device_factory_t device_simulated = {
+    .is_current_device = &is_current_device,
+    .create = &create
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "../device.h"
+#include "../simulator.h"
+
+// Laptop driven by the scripted motion of the simulation. Never matches a real model,
+// it is available only after a simulation is selected.
+extern const laptop_device_factory_t device_simulated;
+
+void device_simulated_set_simulation(simulation_t *simulation);
@@ -0,0 +1,71 @@
+#include "fusion.h"
+
+static inline double wrap_angle(double angle) {
+    while (angle > 180.0) angle -= 360.0;
+    while (angle <= -180.0) angle += 360.0;
+    return angle;
+}
+
+// How much the accelerometer can be trusted as a gravity reference: 0.0 - 1.0
+static inline double accel_trust(const fusion_config_t *config, const accel_state_t *state) {
+    if (!accel_state_has_xz_gravity(state, config->gravity_threshold)) {
+        return 0.0;
+    }
+    double trust = 1.0 - fabs(accel_state_get_magnitude(state) - STANDARD_GRAVITY) / config->max_linear_accel;
+    return trust > 0.0 ? trust : 0.0;
+}
+
+void fusion_config_init(fusion_config_t *config) {
+    config->time_constant = FUSION_TIME_CONSTANT;
+    config->max_linear_accel = FUSION_MAX_LINEAR_ACCEL;
+    config->gravity_threshold = ACCEL_XZ_GRAVITY_THRESHOLD;
+}
+
+void fusion_filter_reset(fusion_filter_t *filter) {
+    filter->angle = 0.0;
+    filter->time = 0.0;
+    filter->corrected_time = 0.0;
+    filter->is_initialized = false;
+    filter->is_tracking = false;
+}
+
+double fusion_filter_update(fusion_filter_t *filter, const fusion_config_t *config, const accel_state_t *state, double time) {
+    double accel_angle = accel_state_get_xz_angle(state);
+    if (!state->has_anglvel) {
+        filter->angle = accel_angle;
+        filter->is_initialized = filter->is_tracking = false;
+        return accel_angle;
+    }
+    
+    double trust = accel_trust(config, state);
+    
+    if (!filter->is_initialized) {
+        // Wait for a good gravity reference before integrating
+        filter->time = time;
+        if (trust <= 0.0) {
+            return accel_angle;
+        }
+        filter->angle = accel_angle;
+        filter->corrected_time = time;
+        filter->is_initialized = filter->is_tracking = true;
+        return accel_angle;
+    }
+    if (trust > 0.0) {
+        filter->corrected_time = time;
+    } else if (time - filter->corrected_time > FUSION_MAX_UNCORRECTED_TIME_CONSTANTS * config->time_constant) {
+        // Start over from the next good gravity reference
+        filter->angle = accel_angle;
+        filter->time = time;
+        filter->is_initialized = filter->is_tracking = false;
+        return accel_angle;
+    }
+    
+    double dt = time - filter->time;
+    if (dt < 0.0) dt = 0.0;
+    double predicted = filter->angle + state->xz_angle_delta;
+    double gain = dt / (config->time_constant + dt) * trust;
+    
+    filter->angle = wrap_angle(predicted + gain * wrap_angle(accel_angle - predicted));
+    filter->time = time;
+    return filter->angle;
+}
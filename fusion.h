@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "device.h"
+
+// Default time constant of the complementary filter in seconds.
+// Accelerometer corrections are blended in with weight dt / (tau + dt).
+#define FUSION_TIME_CONSTANT 0.5
+// Default linear acceleration (deviation from 1g) at which the accelerometer is ignored completely
+#define FUSION_MAX_LINEAR_ACCEL 2.0
+// The gyroscope alone keeps the angle for this many time constants without accelerometer
+// corrections, its drift is unbounded after that
+#define FUSION_MAX_UNCORRECTED_TIME_CONSTANTS 4.0
+#define STANDARD_GRAVITY 9.80665
+
+struct fusion_config_s {
+    double time_constant;     // seconds
+    double max_linear_accel;  // m/s^2
+    double gravity_threshold; // m/s^2, see accel_state_has_xz_gravity
+};
+
+typedef struct fusion_config_s fusion_config_t;
+
+struct fusion_filter_s {
+    double angle;   // fused XZ angle in degrees
+    double time;    // time of the previous sample in seconds
+    double corrected_time; // time of the last accelerometer correction in seconds
+    bool is_initialized;
+    bool is_tracking;
+};
+
+typedef struct fusion_filter_s fusion_filter_t;
+
+void fusion_config_init(fusion_config_t *config);
+
+void fusion_filter_reset(fusion_filter_t *filter);
+
+// Returns the fused XZ angle. Without gyroscope data it is the plain accelerometer angle.
+// The angle is carried between the samples by state->xz_angle_delta.
+double fusion_filter_update(fusion_filter_t *filter, const fusion_config_t *config, const accel_state_t *state, double time);
+
+// True if the angle is kept by the gyroscope and can be used while accelerometer data is unreliable
+static inline bool fusion_filter_is_tracking(const fusion_filter_t *filter) {
+    return filter->is_tracking;
+}
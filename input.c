@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <poll.h>
@@ -6,24 +7,35 @@
 #include <errno.h>
 #include <linux/input.h>
 #include <linux/uinput.h>
-
-#define _GNU_SOURCE
 #include <dirent.h>
+#include <limits.h>
 
 #include "input.h"
 #include "debug.h"
 
-// Emit the event
-static bool emit(int fd, int type, int code, int value) {
-    struct input_event event = {.type = type, .code = code, .value = value};
-    // Set the timestamp (dummy)
-    event.time.tv_sec = 0;
-    event.time.tv_usec = 0;
-    return write(fd, &event, sizeof(event)) == sizeof(event);
+// Events read from the lid switch with one syscall
+#define LID_EVENTS_BATCH 16
+
+static input_stats_t G_input_stats = {0};
+
+const input_stats_t *input_device_get_stats(void) {
+    return &G_input_stats;
+}
+
+// Fill the event. Timestamp is set by the kernel
+static inline void make_event(struct input_event *event, int type, int code, int value) {
+    memset(event, 0, sizeof(*event));
+    event->type = type;
+    event->code = code;
+    event->value = value;
 }
 
-bool input_device_tablet_switch_create(int *fd, char **error) {
+bool input_device_switch_create(const uint16_t *codes, size_t codes_len, int *fd, char **error) {
     *fd = -1;
+    if (codes_len > INPUT_MAX_SWITCHES) {
+        make_errorf(error, "Too many switches: %zu, max %d", codes_len, INPUT_MAX_SWITCHES);
+        return false;
+    }
     int dev = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
     if (dev < 0) {
         make_errorf(error, "Can't open /dev/uinput device: %s", strerror(errno));
@@ -44,11 +56,13 @@ bool input_device_tablet_switch_create(int *fd, char **error) {
         return false;
     }
 
-    // Enable the tabletmode switch
-    if (ioctl(dev, UI_SET_SWBIT, SW_TABLET_MODE) < 0) {
-        close(dev);
-        make_errorf(error, "Can't enable SW_TABLET_MODE events: %s", strerror(errno));
-        return false;
+    // Enable the switches
+    for (size_t i = 0; i < codes_len; i++) {
+        if (ioctl(dev, UI_SET_SWBIT, codes[i]) < 0) {
+            close(dev);
+            make_errorf(error, "Can't enable switch %u events: %s", (unsigned int)codes[i], strerror(errno));
+            return false;
+        }
     }
 
     // Setup the device
@@ -75,25 +89,89 @@ bool input_device_tablet_switch_create(int *fd, char **error) {
     return true;
 }
 
-bool input_device_tablet_switch_set_mode(int fd, bool value, char **error) {
-    if (!emit(fd, EV_SW, SW_TABLET_MODE, (int)value)) {
-        make_errorf(error, "Can't write switch value %s", strerror(errno));
+bool input_device_switch_set_values(int fd, const uint16_t *codes, const bool *values, size_t len, char **error) {
+    // Switch values and the report in one write
+    struct input_event events[INPUT_MAX_SWITCHES + 1];
+    if (len > INPUT_MAX_SWITCHES) {
+        make_errorf(error, "Too many switches: %zu, max %d", len, INPUT_MAX_SWITCHES);
         return false;
     }
-    if (!emit(fd, EV_SYN, SYN_REPORT, 0)) {
-        make_errorf(error, "Can't write switch syn event: %s", strerror(errno));
+    for (size_t i = 0; i < len; i++) {
+        make_event(&events[i], EV_SW, codes[i], (int)values[i]);
+    }
+    make_event(&events[len], EV_SYN, SYN_REPORT, 0);
+    size_t size = (len + 1) * sizeof(struct input_event);
+    G_input_stats.switch_changes += len;
+    G_input_stats.switch_syscalls++;
+    ssize_t written = write(fd, events, size);
+    if (written < 0 || (size_t)written != size) {
+        if (written < 0) {
+            make_errorf(error, "Can't write switch value: %s", strerror(errno));
+        } else {
+            make_errorf(error, "Can't write switch value: %zd of %zu bytes written", written, size);
+        }
         return false;
     }
     return true;
 }
 
-void input_device_tablet_switch_destroy(int *fd) {
+void input_device_switch_destroy(int *fd) {
     if (*fd < 0) return;
     ioctl(*fd, UI_DEV_DESTROY);
     close(*fd);
     *fd = -1;
 }
 
+typedef struct switch_sink_s {
+    output_sink_t sink;
+    int fd;
+} switch_sink_t;
+
+static bool switch_sink_set_values(output_sink_t *self, const uint16_t *codes, const bool *values, size_t len, char **error) {
+    return input_device_switch_set_values(((switch_sink_t*)self)->fd, codes, values, len, error);
+}
+
+static void switch_sink_destroy(output_sink_t *self) {
+    input_device_switch_destroy(&((switch_sink_t*)self)->fd);
+    free((switch_sink_t*)self);
+}
+
+bool input_device_switch_sink_create(const uint16_t *codes, size_t codes_len, output_sink_t **sink, char **error) {
+    switch_sink_t *switch_sink = (switch_sink_t*)malloc(sizeof(switch_sink_t));
+    if (!input_device_switch_create(codes, codes_len, &switch_sink->fd, error)) {
+        free(switch_sink);
+        return false;
+    }
+    switch_sink->sink.set_values = &switch_sink_set_values;
+    switch_sink->sink.destroy = &switch_sink_destroy;
+    *sink = (output_sink_t*)switch_sink;
+    return true;
+}
+
+static bool print_sink_set_values(output_sink_t *self, const uint16_t *codes, const bool *values, size_t len, char **error) {
+    (void)(self);
+    (void)(error);
+    for (size_t i = 0; i < len; i++) {
+        printf("switch %u: %s\n", (unsigned int)codes[i], values[i] ? "true" : "false");
+    }
+    fflush(stdout);
+    G_input_stats.switch_changes += len;
+    return true;
+}
+
+static void print_sink_destroy(output_sink_t *self) {
+    free(self);
+}
+
+bool input_device_print_sink_create(output_sink_t **sink, char **error) {
+    (void)(error);
+    output_sink_t *print_sink = (output_sink_t*)malloc(sizeof(output_sink_t));
+    print_sink->set_values = &print_sink_set_values;
+    print_sink->destroy = &print_sink_destroy;
+    *sink = print_sink;
+    return true;
+}
+
 bool input_device_open_named(const char* device_name, int *fd, char **error) {
     char *path = NULL;
     if (!input_device_find_path(device_name, &path, error)) {
@@ -105,7 +183,7 @@ bool input_device_open_named(const char* device_name, int *fd, char **error) {
 }
 
 bool input_device_open(const char* path, int *fd, char **error) {
-    *fd = open(path, O_RDONLY);
+    *fd = open(path, O_RDONLY | O_NONBLOCK);
     if (*fd < 0) {
         make_errorf(error, "Cannot open the lid switch: %s, error: %s", path, strerror(errno));
         return false;
@@ -121,13 +199,16 @@ bool input_device_find_path(const char *device_name, char **path, char **error)
         return false;
     }
   
-    char entry_file_name[256];
+    char entry_file_name[sizeof("/dev/input/") + NAME_MAX];
     char entry_device_name[256];
     for (int i = 0; i < ndevice; i++) {
         entry_file_name[0] = entry_device_name[0] = '\0';
         // Get the event device name
-        snprintf(entry_file_name, sizeof(entry_file_name), "/dev/input/%s", entry[i]->d_name);
+        int len = snprintf(entry_file_name, sizeof(entry_file_name), "/dev/input/%s", entry[i]->d_name);
         free(entry[i]);
+        if (len < 0 || (size_t)len >= sizeof(entry_file_name)) {
+            continue;
+        }
     
         int fd = open(entry_file_name, O_RDONLY);
         if (fd == -1) {
@@ -139,7 +220,7 @@ bool input_device_find_path(const char *device_name, char **path, char **error)
         // Compare the device name
         if (strncmp(entry_device_name, device_name, sizeof(entry_device_name)) == 0) {
             // cleanup data
-            for (int j = i; j < ndevice; j++) {
+            for (int j = i + 1; j < ndevice; j++) {
                 free(entry[j]);
             }
             free(entry);
@@ -155,48 +236,80 @@ bool input_device_find_path(const char *device_name, char **path, char **error)
     return false;
 }
 
-bool input_device_lid_switch_read(int fd, struct timespec timeout, bool *is_lid_closed, char **error) {
-    struct input_event ev;
-  
+bool input_device_lid_switch_get_state(int fd, bool *is_lid_closed, char **error) {
+    unsigned long bits[SW_MAX / (8 * sizeof(unsigned long)) + 1] = {0};
+    if (fd < 0) {
+        *is_lid_closed = false;
+        return true;
+    }
+    G_input_stats.lid_syscalls++;
+    if (ioctl(fd, EVIOCGSW(sizeof(bits)), bits) < 0) {
+        make_errorf(error, "Can't get the lid switch state: %s", strerror(errno));
+        return false;
+    }
+    size_t bits_per_long = 8 * sizeof(unsigned long);
+    *is_lid_closed = (bits[SW_LID / bits_per_long] >> (SW_LID % bits_per_long)) & 1;
+    return true;
+}
+
+// Reads all pending events. The fd is non-blocking
+bool input_device_lid_switch_drain(int fd, bool *is_lid_closed, char **error) {
+    struct input_event events[LID_EVENTS_BATCH];
+    for (;;) {
+        G_input_stats.lid_syscalls++;
+        ssize_t bytes = read(fd, events, sizeof(events));
+        if (bytes < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return true;
+            }
+            make_errorf(error, "Lid read error: %s", strerror(errno));
+            return false;
+        }
+        if (bytes == 0) {
+            make_error(error, "Lid read error: got 0 bytes");
+            return false;
+        }
+        size_t count = (size_t)bytes / sizeof(struct input_event);
+        for (size_t i = 0; i < count; i++) {
+            const struct input_event *ev = &events[i];
+            if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+                // Events were lost, ask the kernel for the current state
+                if (!input_device_lid_switch_get_state(fd, is_lid_closed, error)) {
+                    return false;
+                }
+            } else if (ev->type == EV_SW && ev->code == SW_LID) {
+                G_input_stats.lid_events++;
+                *is_lid_closed = ev->value == 1;
+                debug(*is_lid_closed ? "Lid closed\n" : "Lid opened\n");
+            }
+        }
+        if (count < LID_EVENTS_BATCH) {
+            return true;
+        }
+    }
+}
+
+bool input_device_lid_switch_read(int fd, const struct timespec *timeout, bool *is_lid_closed, char **error) {
     struct pollfd pfd = {
         .fd = fd,
         .events = POLLIN,
         .revents = 0
     };
-  
-    int rpoll = 0;
-    bool result = true;
-    do {
-        rpoll = ppoll(&pfd, 1, &timeout, NULL);
-        if (rpoll < 0) {
-            result = false;
-            if (errno != EINTR) {
-                make_errorf(error, "Lid poll error: %s", strerror(errno));
-            }
-        } else if (rpoll > 0) {
-            int bytes = read(fd, &ev, sizeof(ev));
-            if (bytes <= 0) {
-                result = false;
-                if (bytes < 0) {
-                    make_errorf(error, "Lid read error: %s", strerror(errno));
-                } else {
-                    make_error(error, "Lid read error: got 0 bytes");
-                }
-            } else {
-                if (ev.type == EV_SW && ev.code == SW_LID) {
-                    if (ev.value == 1) {
-                        debug("Lid closed\n");
-                        *is_lid_closed = true;
-                    } else {
-                        debug("Lid opened\n");
-                        *is_lid_closed = false;
-                    }
-                }
-            }
+    
+    G_input_stats.lid_syscalls++;
+    int rpoll = ppoll(&pfd, 1, timeout, NULL);
+    if (rpoll < 0) {
+        // Interrupted by a signal. Caller decides whether to continue
+        if (errno == EINTR) {
+            return true;
         }
-  } while (rpoll > 0 && result);
-  
-  return result;
+        make_errorf(error, "Lid poll error: %s", strerror(errno));
+        return false;
+    }
+    if (rpoll == 0) {
+        return true;
+    }
+    return input_device_lid_switch_drain(fd, is_lid_closed, error);
 }
 
 void input_device_close(int *fd) {
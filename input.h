@@ -1,15 +1,52 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
-bool input_device_tablet_switch_create(int *fd, char **error);
-bool input_device_tablet_switch_set_mode(int fd, bool value, char **error);
-void input_device_tablet_switch_destroy(int *fd);
+// Switches of the virtual device
+#define INPUT_MAX_SWITCHES 8
+
+struct input_stats_s {
+    uint64_t lid_events;
+    uint64_t lid_syscalls;
+    uint64_t switch_changes;
+    uint64_t switch_syscalls;
+};
+
+typedef struct input_stats_s input_stats_t;
+
+const input_stats_t *input_device_get_stats(void);
+
+// Destination of the switch values: the uinput device, or a recorder in the simulation
+struct output_sink_s {
+    // Reports the values of several switches at once
+    bool (*set_values)(struct output_sink_s *self, const uint16_t *codes, const bool *values, size_t len, char **error);
+    void (*destroy)(struct output_sink_s *self);
+};
+
+typedef struct output_sink_s output_sink_t;
+
+// Sink which writes to a new uinput device with the EV_SW switches
+bool input_device_switch_sink_create(const uint16_t *codes, size_t codes_len, output_sink_t **sink, char **error);
+// Sink which prints the switch values to stdout, used without uinput (--root)
+bool input_device_print_sink_create(output_sink_t **sink, char **error);
+
+// Creates the virtual device with the EV_SW switches, e.g. SW_TABLET_MODE
+bool input_device_switch_create(const uint16_t *codes, size_t codes_len, int *fd, char **error);
+// Reports the values of several switches with one write
+bool input_device_switch_set_values(int fd, const uint16_t *codes, const bool *values, size_t len, char **error);
+void input_device_switch_destroy(int *fd);
 
 bool input_device_open_named(const char* device_name, int *fd, char **error);
 bool input_device_open(const char* path, int *fd, char **error);
 bool input_device_find_path(const char *device_name, char **path, char **error);
-bool input_device_lid_switch_read(int fd, struct timespec timeout, bool *is_lid_closed, char **error);
+// fd is -1 without a lid switch, the lid is open then
+bool input_device_lid_switch_get_state(int fd, bool *is_lid_closed, char **error);
+// Reads the pending events without waiting
+bool input_device_lid_switch_drain(int fd, bool *is_lid_closed, char **error);
+// Waits for the lid events up to timeout (NULL waits forever). Returns early after the events are read.
+bool input_device_lid_switch_read(int fd, const struct timespec *timeout, bool *is_lid_closed, char **error);
 void input_device_close(int *fd);
 
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include "sampler.h"
+#include "stats.h"
+#include "debug.h"
+
+bool sampler_read(laptop_device_t *device, anglvel_integrator_t *integrators, sample_t *sample, char **error) {
+    sample->error = NULL;
+    sample->period = 0.0;
+    double start = stats_now();
+    if (!device->read_sensors(device, &sample->batch, error)) {
+        return false;
+    }
+    sample->time = stats_now();
+    sample->read_time = sample->time - start;
+    sample->skew = sensor_batch_get_skew(&sample->batch);
+    sensor_batch_integrate_anglvel(&sample->batch, integrators);
+    return true;
+}
+
+bool sampler_read_anglvel(laptop_device_t *device, anglvel_integrator_t *integrators, char **error) {
+    sensor_batch_t batch;
+    accel_state_t state;
+    if (!device->read_anglvel(device, &batch, error)) {
+        return false;
+    }
+    for (size_t i = 0; i < batch.sensors_len; i++) {
+        if (batch.is_present[i] && batch.has_anglvel[i]) {
+            sensor_batch_get_state(&batch, i, &state);
+            anglvel_integrator_add(&integrators[i], &state);
+        }
+    }
+    return true;
+}
+
+static bool sampler_push(sampler_t *sampler, const sample_t *sample) {
+    size_t head = atomic_load_explicit(&sampler->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&sampler->tail, memory_order_acquire);
+    if (head - tail >= SAMPLER_RING_SIZE) {
+        atomic_fetch_add_explicit(&sampler->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    sampler->samples[head & (SAMPLER_RING_SIZE - 1)] = *sample;
+    atomic_store_explicit(&sampler->head, head + 1, memory_order_release);
+    uint64_t one = 1;
+    if (write(sampler->event_fd, &one, sizeof(one)) != sizeof(one)) {
+        // Counter is already signalled. Nothing to do
+    }
+    return true;
+}
+
+bool sampler_pop(sampler_t *sampler, sample_t *sample) {
+    size_t tail = atomic_load_explicit(&sampler->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&sampler->head, memory_order_acquire);
+    if (tail == head) {
+        return false;
+    }
+    *sample = sampler->samples[tail & (SAMPLER_RING_SIZE - 1)];
+    atomic_store_explicit(&sampler->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+void sampler_clear_event(sampler_t *sampler) {
+    uint64_t value = 0;
+    if (read(sampler->event_fd, &value, sizeof(value)) != sizeof(value)) {
+        // Nothing was signalled
+    }
+}
+
+void sampler_set_paused(sampler_t *sampler, bool is_paused) {
+    atomic_store_explicit(&sampler->is_paused, is_paused, memory_order_relaxed);
+}
+
+void sampler_set_coarse(sampler_t *sampler, bool is_coarse) {
+    atomic_store_explicit(&sampler->is_coarse, is_coarse, memory_order_relaxed);
+}
+
+void sampler_set_periods(sampler_t *sampler, double period, double coarse_period) {
+    atomic_store_explicit(&sampler->next_period, period, memory_order_relaxed);
+    atomic_store_explicit(&sampler->next_coarse_period, coarse_period, memory_order_relaxed);
+    atomic_store_explicit(&sampler->is_period_changed, true, memory_order_release);
+}
+
+static void *sampler_thread(void *arg) {
+    sampler_t *sampler = (sampler_t *)arg;
+    // Signals are handled by the main thread
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    
+    schedule_t *schedule = &sampler->schedule;
+    double period = schedule_get_period(schedule, false);
+    
+    while (atomic_load_explicit(&sampler->is_running, memory_order_relaxed)) {
+        bool is_paused = atomic_load_explicit(&sampler->is_paused, memory_order_relaxed);
+        bool is_coarse = is_paused || atomic_load_explicit(&sampler->is_coarse, memory_order_relaxed);
+        // The gyroscope is integrated between the samples, except in power mode while idle
+        bool is_integrating = sampler->device->read_anglvel != NULL && !is_paused &&
+            !(is_coarse && schedule_is_coalescing(schedule));
+        // Absolute deadlines: time spent reading doesn't shift the next sample
+        struct timespec deadline = is_integrating ? schedule_deadline_within(schedule, DEVICE_ANGLVEL_PERIOD) :
+            schedule_deadline(schedule);
+        int res = clock_nanosleep(schedule->clock, TIMER_ABSTIME, &deadline, NULL);
+        if (res != 0 && res != EINTR) {
+            break;
+        }
+        if (!schedule_wakeup(schedule)) {
+            char *error = NULL;
+            if (is_integrating && !sampler_read_anglvel(sampler->device, sampler->integrators, &error)) {
+                // Persistent failures are reported by the next sample
+                debug("Cannot read the gyroscope: %s\n", error);
+                error_free(error);
+            }
+            continue;
+        }
+        double sample_period = period;
+        if (atomic_exchange_explicit(&sampler->is_period_changed, false, memory_order_acquire)) {
+            schedule_set_periods(schedule,
+                                 atomic_load_explicit(&sampler->next_period, memory_order_relaxed),
+                                 atomic_load_explicit(&sampler->next_coarse_period, memory_order_relaxed));
+        } else {
+            schedule_next(schedule, is_coarse);
+        }
+        period = schedule_get_period(schedule, is_coarse);
+        if (is_paused) {
+            continue;
+        }
+        sample_t sample;
+        char *error = NULL;
+        if (!sampler_read(sampler->device, sampler->integrators, &sample, &error)) {
+            sample.error = error;
+            // The error must reach the consumer, wait for the space
+            while (!sampler_push(sampler, &sample) && atomic_load_explicit(&sampler->is_running, memory_order_relaxed)) {
+                deadline = schedule_timeout(schedule);
+                clock_nanosleep(schedule->clock, 0, &deadline, NULL);
+            }
+            break;
+        }
+        sample.period = sample_period;
+        sampler_push(sampler, &sample);
+    }
+    return NULL;
+}
+
+bool sampler_start(sampler_t *sampler, laptop_device_t *device, double period, double coarse_period, double tolerance, int rt_priority, int cpu, char **error) {
+    sampler->device = device;
+    schedule_init(&sampler->schedule, period, coarse_period, tolerance);
+    sampler->rt_priority = rt_priority;
+    sampler->cpu = cpu;
+    atomic_init(&sampler->head, 0);
+    atomic_init(&sampler->tail, 0);
+    atomic_init(&sampler->dropped, 0);
+    for (size_t i = 0; i < DEVICE_MAX_SENSORS; i++) {
+        anglvel_integrator_reset(&sampler->integrators[i]);
+    }
+    atomic_init(&sampler->is_paused, false);
+    atomic_init(&sampler->is_coarse, false);
+    atomic_init(&sampler->is_period_changed, false);
+    atomic_init(&sampler->is_running, true);
+    
+    sampler->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sampler->event_fd < 0) {
+        make_errorf(error, "Can't create the sampler eventfd: %s", strerror(errno));
+        return false;
+    }
+    
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (rt_priority > 0) {
+        // Page faults in the sampling thread would break the deadlines
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            debug("Can't lock the memory: %s\n", strerror(errno));
+        }
+        struct sched_param param = { .sched_priority = rt_priority };
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    int res = pthread_create(&sampler->thread, &attr, &sampler_thread, sampler);
+    pthread_attr_destroy(&attr);
+    if (res != 0) {
+        close(sampler->event_fd);
+        sampler->event_fd = -1;
+        make_errorf(error, "Can't start the sampling thread: %s", strerror(res));
+        return false;
+    }
+    debug("Sampling thread started, priority: %d, cpu: %d\n", rt_priority, cpu);
+    return true;
+}
+
+void sampler_stop(sampler_t *sampler) {
+    if (sampler->event_fd < 0) return;
+    atomic_store_explicit(&sampler->is_running, false, memory_order_relaxed);
+    pthread_join(sampler->thread, NULL);
+    // Free errors which weren't consumed
+    sample_t sample;
+    while (sampler_pop(sampler, &sample)) {
+        error_free(sample.error);
+    }
+    close(sampler->event_fd);
+    sampler->event_fd = -1;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "device.h"
+#include "schedule.h"
+
+// Must be a power of two
+#define SAMPLER_RING_SIZE 64
+
+struct sample_s {
+    double time;        // capture time in seconds, CLOCK_MONOTONIC
+    double period;      // scheduled interval since the previous sample in seconds
+    double read_time;   // time spent reading the sensors in seconds
+    sensor_batch_t batch;
+    int64_t skew;       // capture time difference between the sensors in nanoseconds
+    char *error;        // set if the read failed. The sampling thread stops after that
+};
+
+typedef struct sample_s sample_t;
+
+// Sampling thread. Samples are passed to the consumer through a lock-free
+// single-producer/single-consumer ring, event_fd is signalled on each push.
+struct sampler_s {
+    laptop_device_t *device;
+    schedule_t schedule;
+    int rt_priority;    // SCHED_FIFO priority, 0 for normal scheduling
+    int cpu;            // CPU to pin the thread to, -1 to not pin
+    int event_fd;
+    pthread_t thread;
+    atomic_bool is_running;
+    atomic_bool is_paused;
+    atomic_bool is_coarse;
+    // New periods in seconds, applied by the thread at the next tick if is_period_changed is set
+    _Atomic double next_period;
+    _Atomic double next_coarse_period;
+    atomic_bool is_period_changed;
+    atomic_uint_fast64_t dropped;
+    // Gyroscope readings between the samples, used by the thread only
+    anglvel_integrator_t integrators[DEVICE_MAX_SENSORS];
+    atomic_size_t head; // written by the producer
+    atomic_size_t tail; // written by the consumer
+    sample_t samples[SAMPLER_RING_SIZE];
+};
+
+typedef struct sampler_s sampler_t;
+
+// Reads one sample from the device in the calling thread. The gyroscope rates are integrated
+// since the previous sample, see sensor_batch_integrate_anglvel
+bool sampler_read(laptop_device_t *device, anglvel_integrator_t *integrators, sample_t *sample, char **error);
+// Adds a gyroscope reading between the samples. The device must have read_anglvel
+bool sampler_read_anglvel(laptop_device_t *device, anglvel_integrator_t *integrators, char **error);
+
+// tolerance enables aligned deadlines, see schedule_t
+bool sampler_start(sampler_t *sampler, laptop_device_t *device, double period, double coarse_period, double tolerance, int rt_priority, int cpu, char **error);
+// Returns false if the ring is empty
+bool sampler_pop(sampler_t *sampler, sample_t *sample);
+// Clears event_fd after a wakeup
+void sampler_clear_event(sampler_t *sampler);
+void sampler_set_paused(sampler_t *sampler, bool is_paused);
+// Use the long period while no mode transition is plausible
+void sampler_set_coarse(sampler_t *sampler, bool is_coarse);
+// Changes the periods without restarting the thread
+void sampler_set_periods(sampler_t *sampler, double period, double coarse_period);
+void sampler_stop(sampler_t *sampler);
@@ -0,0 +1,107 @@
+#include "schedule.h"
+
+static inline struct timespec ns_to_timespec(int64_t ns) {
+    struct timespec ts = {
+        .tv_sec = ns / 1000000000,
+        .tv_nsec = ns % 1000000000
+    };
+    return ts;
+}
+
+static void schedule_store_periods(schedule_t *schedule, double period, double coarse_period) {
+    schedule->period = (int64_t)(period * 1000000000.0);
+    if (schedule->period <= 0) schedule->period = 1;
+    schedule->coarse_period = (int64_t)(coarse_period * 1000000000.0);
+    if (schedule->coarse_period <= 0) schedule->coarse_period = schedule->period * SCHEDULE_COARSE_FACTOR;
+}
+
+void schedule_init(schedule_t *schedule, double period, double coarse_period, double tolerance) {
+    schedule_store_periods(schedule, period, coarse_period);
+    schedule->tolerance = tolerance > 0 ? (int64_t)(tolerance * 1000000000.0) : 0;
+    schedule->clock = schedule->tolerance > 0 ? CLOCK_BOOTTIME : CLOCK_MONOTONIC;
+    schedule->virtual_now = NULL;
+    schedule->started = schedule_now(schedule);
+    schedule->deadline = schedule->started;
+    schedule->wakeups = 0;
+    schedule->misses = 0;
+    schedule_next(schedule, false);
+}
+
+void schedule_set_virtual_clock(schedule_t *schedule, const int64_t *now) {
+    schedule->virtual_now = now;
+    schedule->started = schedule_now(schedule);
+    schedule->deadline = schedule->started;
+    schedule_next(schedule, false);
+}
+
+void schedule_set_periods(schedule_t *schedule, double period, double coarse_period) {
+    schedule_store_periods(schedule, period, coarse_period);
+    schedule->deadline = schedule_now(schedule);
+    schedule_next(schedule, false);
+}
+
+int64_t schedule_now(const schedule_t *schedule) {
+    if (schedule->virtual_now != NULL) {
+        return *schedule->virtual_now;
+    }
+    struct timespec ts;
+    clock_gettime(schedule->clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+double schedule_get_period(const schedule_t *schedule, bool is_coarse) {
+    int64_t period = schedule->period;
+    if (is_coarse && schedule_is_coalescing(schedule)) {
+        period = schedule->coarse_period;
+    }
+    return (double)period / 1000000000.0;
+}
+
+void schedule_next(schedule_t *schedule, bool is_coarse) {
+    int64_t now = schedule_now(schedule);
+    int64_t period = schedule->period;
+    if (schedule_is_coalescing(schedule)) {
+        if (is_coarse) period = schedule->coarse_period;
+        // Next multiple of the period
+        schedule->deadline = (now / period + 1) * period;
+        return;
+    }
+    schedule->deadline += period;
+    // Don't try to catch up the missed ticks
+    if (schedule->deadline <= now) {
+        schedule->deadline = now + period;
+    }
+}
+
+struct timespec schedule_timeout(const schedule_t *schedule) {
+    int64_t left = schedule->deadline - schedule_now(schedule);
+    return ns_to_timespec(left > 0 ? left : 0);
+}
+
+struct timespec schedule_deadline(const schedule_t *schedule) {
+    return ns_to_timespec(schedule->deadline);
+}
+
+struct timespec schedule_deadline_within(const schedule_t *schedule, double interval) {
+    int64_t deadline = schedule_now(schedule) + (int64_t)(interval * 1000000000.0);
+    return ns_to_timespec(deadline < schedule->deadline ? deadline : schedule->deadline);
+}
+
+bool schedule_wakeup(schedule_t *schedule) {
+    int64_t now = schedule_now(schedule);
+    schedule->wakeups++;
+    if (now < schedule->deadline) {
+        return false;
+    }
+    // The kernel may use the whole timer slack in power mode
+    int64_t threshold = schedule->tolerance + SCHEDULE_MISS_THRESHOLD;
+    if (now - schedule->deadline > threshold) {
+        schedule->misses++;
+    }
+    return true;
+}
+
+double schedule_wakeups_per_second(const schedule_t *schedule) {
+    double elapsed = (double)(schedule_now(schedule) - schedule->started) / 1000000000.0;
+    return elapsed > 0 ? (double)schedule->wakeups / elapsed : 0.0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// Default period multiplier used when no mode transition is plausible
+#define SCHEDULE_COARSE_FACTOR 4
+// Lateness beyond the timer slack counted as a deadline miss
+#define SCHEDULE_MISS_THRESHOLD 1000000
+
+// Tick deadlines. With a non-zero tolerance deadlines are aligned to the
+// multiples of the period on CLOCK_BOOTTIME, so they coalesce with other
+// periodic wakeups in the system.
+struct schedule_s {
+    clockid_t clock;
+    int64_t period;     // ns
+    int64_t coarse_period; // ns, used in power mode while no mode transition is plausible
+    int64_t tolerance;  // ns, 0 disables coalescing
+    int64_t deadline;   // ns on clock
+    int64_t started;    // ns on clock
+    uint64_t wakeups;
+    uint64_t misses;
+    const int64_t *virtual_now; // ns, clock of the simulation. NULL uses the system clock
+};
+
+typedef struct schedule_s schedule_t;
+
+// coarse_period <= 0 selects SCHEDULE_COARSE_FACTOR * period
+void schedule_init(schedule_t *schedule, double period, double coarse_period, double tolerance);
+// Runs the schedule on the given clock from now on, for the simulation
+void schedule_set_virtual_clock(schedule_t *schedule, const int64_t *now);
+// Changes the periods in place. The next deadline is recomputed from now
+void schedule_set_periods(schedule_t *schedule, double period, double coarse_period);
+
+static inline bool schedule_is_coalescing(const schedule_t *schedule) {
+    return schedule->tolerance > 0;
+}
+
+int64_t schedule_now(const schedule_t *schedule);
+// Period of the next tick in seconds
+double schedule_get_period(const schedule_t *schedule, bool is_coarse);
+// Moves the deadline to the next tick
+void schedule_next(schedule_t *schedule, bool is_coarse);
+// Time left until the deadline, zero if it already passed
+struct timespec schedule_timeout(const schedule_t *schedule);
+struct timespec schedule_deadline(const schedule_t *schedule);
+// The deadline or interval seconds from now, whichever is earlier
+struct timespec schedule_deadline_within(const schedule_t *schedule, double interval);
+// Counts the wakeup. Returns true if the deadline is reached
+bool schedule_wakeup(schedule_t *schedule);
+double schedule_wakeups_per_second(const schedule_t *schedule);
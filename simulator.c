@@ -0,0 +1,341 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <linux/input.h>
+
+#include "simulator.h"
+#include "fusion.h"
+#include "debug.h"
+
+#define STEPS_LEN(steps) (sizeof(steps) / sizeof(steps[0]))
+
+// Laptop on a table is folded into a tablet and back
+static const simulation_step_t G_fold_steps[] = {
+    { .duration = 3.0, .hinge_angle = 110.0, .noise = 0.1 },
+    { .duration = 1.0, .hinge_angle = 350.0, .noise = 0.1 },
+    { .duration = 4.0, .hinge_angle = 350.0, .noise = 0.1 },
+    { .duration = 1.0, .hinge_angle = 110.0, .noise = 0.1 },
+    { .duration = 3.0, .hinge_angle = 110.0, .noise = 0.1 }
+};
+
+// Same with the gyroscope, a fast fold and a bump in the middle of it
+static const simulation_step_t G_gyro_fold_steps[] = {
+    { .duration = 3.0, .hinge_angle = 110.0, .noise = 0.1 },
+    { .duration = 0.2, .hinge_angle = 230.0, .noise = 0.1, .bump = 6.0 },
+    { .duration = 0.2, .hinge_angle = 350.0, .noise = 0.1 },
+    { .duration = 4.0, .hinge_angle = 350.0, .noise = 0.1 },
+    { .duration = 0.4, .hinge_angle = 110.0, .noise = 0.1 },
+    { .duration = 3.0, .hinge_angle = 110.0, .noise = 0.1 }
+};
+
+// Typing on the laptop on a wobbly surface
+static const simulation_step_t G_bumps_steps[] = {
+    { .duration = 2.0, .hinge_angle = 120.0, .noise = 0.1 },
+    { .duration = 0.5, .hinge_angle = 120.0, .noise = 0.5, .bump = 8.0 },
+    { .duration = 1.0, .hinge_angle = 120.0, .noise = 0.1 },
+    { .duration = 0.5, .hinge_angle = 120.0, .noise = 0.5, .bump = -8.0 },
+    { .duration = 1.0, .hinge_angle = 120.0, .noise = 0.1 },
+    { .duration = 0.5, .hinge_angle = 120.0, .noise = 0.5, .bump = 8.0 },
+    { .duration = 2.0, .hinge_angle = 120.0, .noise = 0.1 }
+};
+
+// Open laptop carried around
+static const simulation_step_t G_carry_steps[] = {
+    { .duration = 2.0, .hinge_angle = 100.0, .noise = 0.1 },
+    { .duration = 1.0, .hinge_angle = 100.0, .base_angle = -30.0, .sway = 25.0, .noise = 2.0 },
+    { .duration = 10.0, .hinge_angle = 100.0, .base_angle = -30.0, .sway = 25.0, .noise = 2.0 },
+    { .duration = 1.0, .hinge_angle = 100.0, .noise = 0.1 },
+    { .duration = 2.0, .hinge_angle = 100.0, .noise = 0.1 }
+};
+
+// Held on the side with a drifting gyroscope. No gravity is left in the XZ plane, so the
+// gyroscope alone must not be trusted for long
+static const simulation_step_t G_gyro_side_steps[] = {
+    { .duration = 2.0, .hinge_angle = 110.0, .noise = 0.1 },
+    { .duration = 1.0, .hinge_angle = 110.0, .roll = 90.0, .noise = 0.1, .gyro_drift = 20.0 },
+    { .duration = 12.0, .hinge_angle = 110.0, .roll = 90.0, .noise = 0.1, .gyro_drift = 20.0 },
+    { .duration = 1.0, .hinge_angle = 110.0, .noise = 0.1 },
+    { .duration = 2.0, .hinge_angle = 110.0, .noise = 0.1 }
+};
+
+// Laptop is closed and opened, the lid switch is closed below 15 degrees
+static const simulation_step_t G_close_steps[] = {
+    { .duration = 2.0, .hinge_angle = 110.0, .noise = 0.1 },
+    { .duration = 1.0, .hinge_angle = 15.0, .noise = 0.1 },
+    { .duration = 0.5, .hinge_angle = 0.0, .noise = 0.1, .is_lid_closed = true },
+    { .duration = 2.0, .hinge_angle = 0.0, .noise = 0.1, .is_lid_closed = true },
+    { .duration = 0.5, .hinge_angle = 15.0, .noise = 0.1, .is_lid_closed = true },
+    { .duration = 1.0, .hinge_angle = 110.0, .noise = 0.1 },
+    { .duration = 2.0, .hinge_angle = 110.0, .noise = 0.1 }
+};
+
+// Folded while held on the side, little gravity is left in the XZ plane
+static const simulation_step_t G_upright_steps[] = {
+    { .duration = 2.0, .hinge_angle = 110.0, .roll = 72.0, .noise = 0.3 },
+    { .duration = 1.0, .hinge_angle = 350.0, .roll = 72.0, .noise = 0.3 },
+    { .duration = 5.0, .hinge_angle = 350.0, .roll = 72.0, .noise = 0.3 },
+    { .duration = 1.0, .hinge_angle = 110.0, .roll = 72.0, .noise = 0.3 },
+    { .duration = 5.0, .hinge_angle = 110.0, .roll = 72.0, .noise = 0.3 }
+};
+
+// Laptop with a hinge angle sensor. Nearly closed before the lid switch triggers, then folded
+static const simulation_step_t G_hinge_steps[] = {
+    { .duration = 2.0, .hinge_angle = 110.0, .noise = 0.5 },
+    { .duration = 1.0, .hinge_angle = 5.0, .noise = 0.5 },
+    { .duration = 3.0, .hinge_angle = 5.0, .noise = 0.5 },
+    { .duration = 1.0, .hinge_angle = 110.0, .noise = 0.5 },
+    { .duration = 2.0, .hinge_angle = 110.0, .noise = 0.5 },
+    { .duration = 1.0, .hinge_angle = 350.0, .noise = 0.5 },
+    { .duration = 3.0, .hinge_angle = 350.0, .noise = 0.5 },
+    { .duration = 1.0, .hinge_angle = 110.0, .noise = 0.5 },
+    { .duration = 2.0, .hinge_angle = 110.0, .noise = 0.5 }
+};
+
+// Fold with sensor failures: a transient one, one during the fold which needs retries, and
+// one during the unfold
+static const simulation_step_t G_faults_steps[] = {
+    { .duration = 2.0, .hinge_angle = 110.0, .noise = 0.1 },
+    { .duration = 1.0, .hinge_angle = 110.0, .noise = 0.1, .is_faulty = true },
+    { .duration = 1.0, .hinge_angle = 350.0, .noise = 0.1, .is_faulty = true, .failed_recoveries = 2 },
+    { .duration = 4.0, .hinge_angle = 350.0, .noise = 0.1 },
+    { .duration = 1.0, .hinge_angle = 110.0, .noise = 0.1, .is_faulty = true, .failed_recoveries = 1 },
+    { .duration = 3.0, .hinge_angle = 110.0, .noise = 0.1 }
+};
+
+// Keyboard of a detachable is removed and attached again, the screen stays upright
+static const simulation_step_t G_detach_steps[] = {
+    { .duration = 2.0, .hinge_angle = 110.0, .noise = 0.1 },
+    { .duration = 4.0, .hinge_angle = 110.0, .noise = 0.1, .is_detached = true },
+    { .duration = 3.0, .hinge_angle = 110.0, .noise = 0.1 }
+};
+
+static const simulation_scenario_t G_scenarios[] = {
+    { "fold", "Fold into a tablet and back on a table", false, false,
+      STEPS_LEN(G_fold_steps), G_fold_steps, 2, 1.5 },
+    { "gyro-fold", "Fast fold with a bump, gyroscope available", true, false,
+      STEPS_LEN(G_gyro_fold_steps), G_gyro_fold_steps, 2, 1.5 },
+    { "gyro-side", "Held on the side with a drifting gyroscope, no switch expected", true, false,
+      STEPS_LEN(G_gyro_side_steps), G_gyro_side_steps, 0, 0.0 },
+    { "bumps", "Bumps while typing, no switch expected", false, false,
+      STEPS_LEN(G_bumps_steps), G_bumps_steps, 0, 0.0 },
+    { "carry", "Open laptop carried around, no switch expected", false, false,
+      STEPS_LEN(G_carry_steps), G_carry_steps, 0, 0.0 },
+    { "close", "Lid closed and opened, no switch expected", false, false,
+      STEPS_LEN(G_close_steps), G_close_steps, 0, 0.0 },
+    { "upright", "Fold and unfold held on the side", false, false,
+      STEPS_LEN(G_upright_steps), G_upright_steps, 2, 3.0, true },
+    { "hinge", "Hinge angle sensor, nearly closed and folded", false, true,
+      STEPS_LEN(G_hinge_steps), G_hinge_steps, 2, 1.5 },
+    { "faults", "Fold with failing sensor reads and recoveries", false, false,
+      STEPS_LEN(G_faults_steps), G_faults_steps, 2, 1.5 },
+    { "detach", "Keyboard of a detachable removed and attached again", false, false,
+      STEPS_LEN(G_detach_steps), G_detach_steps, 2, 1.5, false, 2, 1u << 1 },
+    { "trifold", "Three panels, both hinges folded back and unfolded", false, false,
+      STEPS_LEN(G_fold_steps), G_fold_steps, 2, 1.5, false, 3 },
+    { "panels", "Fold with the largest layout, shows the per-tick cost of the hinges", false, false,
+      STEPS_LEN(G_fold_steps), G_fold_steps, 2, 1.5, false, DEVICE_MAX_SENSORS }
+};
+
+static bool simulation_sink_set_values(output_sink_t *self, const uint16_t *codes, const bool *values, size_t len, char **error) {
+    simulation_t *simulation = (simulation_t*)self;
+    for (size_t i = 0; i < len; i++) {
+        if (simulation->events_len >= SIMULATION_MAX_EVENTS) {
+            make_error(error, "Too many switch events in the simulation");
+            return false;
+        }
+        simulation_event_t *event = &simulation->events[simulation->events_len++];
+        event->time = simulation->time;
+        event->code = codes[i];
+        event->value = values[i];
+    }
+    return true;
+}
+
+static void simulation_sink_destroy(output_sink_t *self) {
+    (void)(self);
+}
+
+bool simulation_init(simulation_t *simulation, const char *scenario_name, char **error) {
+    simulation->scenario = NULL;
+    for (size_t i = 0; i < sizeof(G_scenarios) / sizeof(G_scenarios[0]); i++) {
+        if (strcmp(G_scenarios[i].name, scenario_name) == 0) {
+            simulation->scenario = &G_scenarios[i];
+            break;
+        }
+    }
+    if (simulation->scenario == NULL) {
+        make_errorf(error, "Unknown scenario: %s", scenario_name);
+        return false;
+    }
+    simulation->sink.set_values = &simulation_sink_set_values;
+    simulation->sink.destroy = &simulation_sink_destroy;
+    simulation->time = 0.0;
+    // Fixed seed, so the runs are reproducible
+    simulation->random = 0x9E3779B97F4A7C15ull;
+    simulation->events_len = 0;
+    simulation->lid_fd = -1;
+    simulation->is_lid_closed = false;
+    return true;
+}
+
+bool simulation_open_lid(simulation_t *simulation, int *fd, char **error) {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        make_errorf(error, "Cannot create the simulated lid switch: %s", strerror(errno));
+        return false;
+    }
+    *fd = fds[0];
+    simulation->lid_fd = fds[1];
+    simulation->is_lid_closed = simulation_is_lid_closed(simulation);
+    return true;
+}
+
+bool simulation_update_lid(simulation_t *simulation, bool *is_changed, char **error) {
+    bool is_lid_closed = simulation_is_lid_closed(simulation);
+    *is_changed = is_lid_closed != simulation->is_lid_closed;
+    if (!*is_changed) {
+        return true;
+    }
+    simulation->is_lid_closed = is_lid_closed;
+    struct input_event events[2];
+    memset(events, 0, sizeof(events));
+    events[0].type = EV_SW;
+    events[0].code = SW_LID;
+    events[0].value = is_lid_closed ? 1 : 0;
+    events[1].type = EV_SYN;
+    events[1].code = SYN_REPORT;
+    if (write(simulation->lid_fd, events, sizeof(events)) != (ssize_t)sizeof(events)) {
+        make_errorf(error, "Cannot write the simulated lid event: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void simulation_close_lid(simulation_t *simulation) {
+    if (simulation->lid_fd >= 0) {
+        close(simulation->lid_fd);
+        simulation->lid_fd = -1;
+    }
+}
+
+void simulation_print_scenarios(FILE *file) {
+    for (size_t i = 0; i < sizeof(G_scenarios) / sizeof(G_scenarios[0]); i++) {
+        fprintf(file, "  %-10s %s\n", G_scenarios[i].name, G_scenarios[i].description);
+    }
+}
+
+double simulation_get_duration(const simulation_t *simulation) {
+    double duration = 0.0;
+    for (size_t i = 0; i < simulation->scenario->steps_len; i++) {
+        duration += simulation->scenario->steps[i].duration;
+    }
+    return duration;
+}
+
+void simulation_set_time(simulation_t *simulation, double time) {
+    simulation->time = time;
+}
+
+// Uniform in [-1, 1], xorshift64*
+static double simulation_random(simulation_t *simulation) {
+    uint64_t x = simulation->random;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    simulation->random = x;
+    return (double)((x * 0x2545F4914F6CDD1Dull) >> 11) / (double)(1ull << 52) - 1.0;
+}
+
+struct simulation_pose_s {
+    const simulation_step_t *step;
+    double hinge_angle;
+    double hinge_rate;  // deg/s
+    double base_angle;
+    double base_rate;   // deg/s
+    double roll;
+};
+
+typedef struct simulation_pose_s simulation_pose_t;
+
+static void simulation_get_pose(const simulation_t *simulation, simulation_pose_t *pose) {
+    const simulation_scenario_t *scenario = simulation->scenario;
+    const simulation_step_t *prev = &scenario->steps[0];
+    const simulation_step_t *step = prev;
+    double start = 0.0;
+    for (size_t i = 0; i < scenario->steps_len; i++) {
+        step = &scenario->steps[i];
+        if (simulation->time < start + step->duration || i + 1 == scenario->steps_len) break;
+        start += step->duration;
+        prev = step;
+    }
+    double k = (simulation->time - start) / step->duration;
+    if (k > 1.0) k = 1.0;
+    pose->step = step;
+    pose->hinge_angle = prev->hinge_angle + (step->hinge_angle - prev->hinge_angle) * k;
+    pose->hinge_rate = (step->hinge_angle - prev->hinge_angle) / step->duration;
+    pose->base_angle = prev->base_angle + (step->base_angle - prev->base_angle) * k;
+    pose->base_rate = (step->base_angle - prev->base_angle) / step->duration;
+    pose->roll = prev->roll + (step->roll - prev->roll) * k;
+    if (step->sway != 0.0) {
+        double phase = 2.0 * M_PI * simulation->time;
+        pose->base_angle += step->sway * sin(phase);
+        pose->base_rate += step->sway * 2.0 * M_PI * cos(phase);
+    }
+}
+
+double simulation_get_hinge_angle(const simulation_t *simulation) {
+    simulation_pose_t pose;
+    simulation_get_pose(simulation, &pose);
+    return pose.hinge_angle;
+}
+
+bool simulation_is_lid_closed(const simulation_t *simulation) {
+    simulation_pose_t pose;
+    simulation_get_pose(simulation, &pose);
+    return pose.step->is_lid_closed;
+}
+
+bool simulation_is_detached(const simulation_t *simulation) {
+    simulation_pose_t pose;
+    simulation_get_pose(simulation, &pose);
+    return pose.step->is_detached && simulation->scenario->detachable != 0;
+}
+
+const simulation_step_t *simulation_get_step(const simulation_t *simulation) {
+    simulation_pose_t pose;
+    simulation_get_pose(simulation, &pose);
+    return pose.step;
+}
+
+void simulation_read_accel(simulation_t *simulation, size_t sensor, accel_state_t *state) {
+    simulation_pose_t pose;
+    simulation_get_pose(simulation, &pose);
+    // XZ angle of the sensor, see accel_state_get_xz_angle. The hinge angle is base - screen,
+    // and the same between each pair of neighbours
+    double panel = (double)sensor - 1.0;
+    double angle = pose.base_angle + panel * pose.hinge_angle;
+    double rate = pose.base_rate + panel * pose.hinge_rate;
+    if (sensor == 0) {
+        rate += pose.step->gyro_drift;
+    }
+    double radians = angle * M_PI / 180.0;
+    double roll = pose.roll * M_PI / 180.0;
+    double noise = pose.step->noise;
+    state->x = -STANDARD_GRAVITY * sin(radians) * cos(roll) + pose.step->bump + noise * simulation_random(simulation);
+    state->y = STANDARD_GRAVITY * sin(roll) + noise * simulation_random(simulation);
+    state->z = STANDARD_GRAVITY * cos(radians) * cos(roll) + noise * simulation_random(simulation);
+    state->has_anglvel = simulation->scenario->has_anglvel;
+    state->anglvel.x = 0.0;
+    state->anglvel.y = rate * M_PI / 180.0;
+    state->anglvel.z = 0.0;
+    state->timestamp = (int64_t)(simulation->time * 1000000000.0);
+}
+
+double simulation_read_hinge_angle(simulation_t *simulation) {
+    simulation_pose_t pose;
+    simulation_get_pose(simulation, &pose);
+    return pose.hinge_angle + pose.step->noise * simulation_random(simulation);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "device.h"
+#include "input.h"
+
+// Switch events recorded by the simulation sink
+#define SIMULATION_MAX_EVENTS 256
+
+// Part of the scripted motion. The hinge and the base move linearly from the values at
+// the end of the previous step to the values of this step.
+struct simulation_step_s {
+    double duration;      // seconds
+    double hinge_angle;   // degrees, 0 is closed, 360 is folded back
+    double base_angle;    // XZ angle of the base in degrees, 0 is lying flat
+    double roll;          // degrees, rotation around the X axis. Moves gravity out of the XZ plane
+    double sway;          // degrees, 1 Hz swing of the whole device added to base_angle (carrying)
+    double noise;         // m/s^2, amplitude of the uniform sensor noise. Degrees for a hinge angle sensor
+    double bump;          // m/s^2, linear acceleration along X during the step
+    double gyro_drift;    // deg/s, rate error of the screen gyroscope
+    bool is_lid_closed;
+    // The detachable sensors of the scenario are absent (keyboard of a detachable removed)
+    bool is_detached;
+    // The first sensor read of the step fails, and the recovery fails this many times before
+    // the sensors are back
+    bool is_faulty;
+    size_t failed_recoveries;
+};
+
+typedef struct simulation_step_s simulation_step_t;
+
+struct simulation_scenario_s {
+    const char *name;
+    const char *description;
+    bool has_anglvel;
+    // The laptop has a hinge angle sensor instead of the accelerometers
+    bool has_hinge_sensor;
+    size_t steps_len;
+    const simulation_step_t *steps;
+    // Expected number of switch events
+    size_t expected_toggles;
+    // Limit for the time from the ground truth transition to the switch event, in poll periods
+    double max_latency;
+    // Expected to fail without the calibration, the fixed gravity threshold rejects most samples
+    bool needs_calibration;
+    // Accelerometers in a row with a hinge between the neighbours, 0 means the screen and the base
+    size_t panels;
+    // Mask of the sensors absent in the detached steps
+    uint32_t detachable;
+};
+
+typedef struct simulation_scenario_s simulation_scenario_t;
+
+struct simulation_event_s {
+    double time;
+    uint16_t code;
+    bool value;
+};
+
+typedef struct simulation_event_s simulation_event_t;
+
+// Scripted laptop in virtual time. The sink is the first member, so the simulation
+// can be used as output_sink_t.
+struct simulation_s {
+    output_sink_t sink;
+    const simulation_scenario_t *scenario;
+    double time;        // virtual time in seconds
+    uint64_t random;    // noise generator state
+    size_t events_len;
+    simulation_event_t events[SIMULATION_MAX_EVENTS];
+    // Write end of the lid switch pipe, and the last written lid state
+    int lid_fd;
+    bool is_lid_closed;
+};
+
+typedef struct simulation_s simulation_t;
+
+bool simulation_init(simulation_t *simulation, const char *scenario_name, char **error);
+void simulation_print_scenarios(FILE *file);
+
+double simulation_get_duration(const simulation_t *simulation);
+void simulation_set_time(simulation_t *simulation, double time);
+
+// Ground truth at the current time, without noise
+double simulation_get_hinge_angle(const simulation_t *simulation);
+bool simulation_is_lid_closed(const simulation_t *simulation);
+bool simulation_is_detached(const simulation_t *simulation);
+// Step at the current time
+const simulation_step_t *simulation_get_step(const simulation_t *simulation);
+
+// The lid switch events of the script are written to a pipe, fd is its read end. The lid
+// starts in the state of the script at time 0
+bool simulation_open_lid(simulation_t *simulation, int *fd, char **error);
+// Writes the lid events if the lid changed at the current time
+bool simulation_update_lid(simulation_t *simulation, bool *is_changed, char **error);
+void simulation_close_lid(simulation_t *simulation);
+
+// Sensor 0 is the screen, 1 is the base, the next panels follow in a row and fold by the hinge
+// angle in alternating directions
+void simulation_read_accel(simulation_t *simulation, size_t sensor, accel_state_t *state);
+// Value of the hinge angle sensor in degrees
+double simulation_read_hinge_angle(simulation_t *simulation);
@@ -0,0 +1,32 @@
+#include <time.h>
+
+#include "stats.h"
+#include "debug.h"
+
+double stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+void stats_timer_add(stats_timer_t *timer, double value) {
+    if (timer->count == 0 || value < timer->min) {
+        timer->min = value;
+    }
+    if (timer->count == 0 || value > timer->max) {
+        timer->max = value;
+    }
+    timer->total += value;
+    timer->count++;
+}
+
+// Values are printed in milliseconds
+void stats_timer_print(const char *name, const stats_timer_t *timer) {
+    if (timer->count == 0) {
+        debug("%s: no samples\n", name);
+        return;
+    }
+    debug("%s: count:%llu mean:%.3lfms min:%.3lfms max:%.3lfms\n", name,
+          (unsigned long long)timer->count, timer->total / timer->count * 1000.0,
+          timer->min * 1000.0, timer->max * 1000.0);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+struct stats_timer_s {
+    uint64_t count;
+    double total;
+    double min;
+    double max;
+};
+
+typedef struct stats_timer_s stats_timer_t;
+
+// Monotonic time in seconds
+double stats_now(void);
+
+void stats_timer_add(stats_timer_t *timer, double value);
+void stats_timer_print(const char *name, const stats_timer_t *timer);